@@ -0,0 +1,89 @@
+// bitset.h - Fixed-width bitset helpers
+
+#ifndef ECS_BITSET_H
+#define ECS_BITSET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    A bitset is a plain array of 64-bit words, with bit N stored in word
+    N / 64. The caller owns the memory and keeps track of the number of words.
+
+    Bitsets of different lengths can be compared; missing words are treated
+    as zero.
+*/
+typedef uint64_t bitset_t;
+
+#define BITSET_WORD_BITS 64
+#define BITSET_WORDS(bits) (((bits) + BITSET_WORD_BITS - 1) / BITSET_WORD_BITS)
+
+static inline void bs_set(bitset_t *bs, size_t bit)
+{
+    bs[bit / BITSET_WORD_BITS] |= (bitset_t)1 << (bit % BITSET_WORD_BITS);
+}
+
+static inline void bs_clear(bitset_t *bs, size_t bit)
+{
+    bs[bit / BITSET_WORD_BITS] &= ~((bitset_t)1 << (bit % BITSET_WORD_BITS));
+}
+
+static inline bool bs_get(const bitset_t *bs, size_t bit)
+{
+    return (bs[bit / BITSET_WORD_BITS] >> (bit % BITSET_WORD_BITS)) & 1;
+}
+
+/*
+    Returns whether every bit set in `a` is also set in `b`.
+*/
+static inline bool bs_subset(const bitset_t *a, size_t a_words, const bitset_t *b, size_t b_words)
+{
+    for (size_t idx = 0; idx < a_words; idx++) {
+        bitset_t word = idx < b_words ? b[idx] : 0;
+        if (a[idx] & ~word) return false;
+    }
+
+    return true;
+}
+
+/*
+    Returns whether `a` and `b` have at least one bit in common.
+*/
+static inline bool bs_intersects(const bitset_t *a, size_t a_words, const bitset_t *b, size_t b_words)
+{
+    size_t words = a_words < b_words ? a_words : b_words;
+    for (size_t idx = 0; idx < words; idx++) {
+        if (a[idx] & b[idx]) return true;
+    }
+
+    return false;
+}
+
+/*
+    Returns the index of the first set bit at or after `bit`, or
+    words * BITSET_WORD_BITS if there is none.
+*/
+static inline size_t bs_next(const bitset_t *bs, size_t words, size_t bit)
+{
+    size_t idx = bit / BITSET_WORD_BITS;
+    if (idx >= words) return words * BITSET_WORD_BITS;
+
+    // Mask off the bits below the starting bit.
+    bitset_t word = bs[idx] & (~(bitset_t)0 << (bit % BITSET_WORD_BITS));
+    while (!word) {
+        if (++idx >= words) return words * BITSET_WORD_BITS;
+        word = bs[idx];
+    }
+
+    return idx * BITSET_WORD_BITS + __builtin_ctzll(word);
+}
+
+/*
+    Iterate over the set bits of a bitset.
+*/
+#define BS_FOR(bs, words) \
+    for (size_t bit = bs_next(bs, words, 0); bit < (words) * BITSET_WORD_BITS; \
+        bit = bs_next(bs, words, bit + 1))
+
+#endif /* end of include guard: ECS_BITSET_H */
@@ -34,18 +34,35 @@ typedef void (*component_delete_func)(Component*);
 
 	ComponentStorageNormal:
 		A 1:1 mapping between components and their data. Component data creation
-		and deletion is manually controlled by instantiation code.
+		and deletion is manually controlled by instantiation code. Adding or
+		removing a component of this type may move the other components of the
+		same type, invalidating pointers to them.
 	ComponentStorageFlyweight:
 		Components follow the flyweight pattern. Multiple components reference the
 		same component data. Useful for read-only components.
 	ComponentStorageNone:
 		Used for empty components that are just used as a signalling mechanism.
 		Component creation and deletion functions will not be called.
+	ComponentStorageChunked:
+		Like ComponentStorageNormal, but entities with the same set of chunked
+		components are grouped together, and each component type is stored in
+		a contiguous array. Systems operating only on chunked components
+		iterate these arrays linearly. Adding or removing a chunked component
+		moves the entity's chunked components, invalidating pointers to them.
+	ComponentStorageSparse:
+		Like ComponentStorageNormal, but components are stored in a packed
+		array with a sparse entity-to-index table. Lookups are two array
+		indexes, and adding or removing the component is O(1) and does not
+		move the entity's other components. Suited to components that are
+		added and removed frequently. Adding or removing a component of this
+		type invalidates pointers to other components of the same type.
 */
 typedef enum {
 	ComponentStorageNormal,
     ComponentStorageFlyweight,
-    ComponentStorageNone
+    ComponentStorageNone,
+    ComponentStorageChunked,
+    ComponentStorageSparse
 } ComponentStorage;
 
 /*
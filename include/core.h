@@ -12,6 +12,8 @@
 #include "hashtable.h"
 #include "hasharray.h"
 #include "hashset.h"
+#include "sparseset.h"
+#include "bitset.h"
 #include "dynarray.h"
 
 /*
@@ -19,6 +21,7 @@
 */
 
 typedef struct Event Event;
+typedef void EventData;
 
 /*
     A component is an encapsulation of a set of data, usually related to a
@@ -40,9 +43,25 @@ typedef struct {
 /*
     The basic unit of objects. Each entity may be associated with one or more
     components.
+
+    An entity handle stores the entity's index in the ECS's entity registry in
+    its lower ENTITY_INDEX_BITS bits, and a generation counter in the upper
+    bits. The generation is bumped whenever an index is freed, so handles to
+    deleted entities can be detected even after their index is reused.
+
+    Generation 0 is never used, so an Entity of 0 never refers to a live
+    entity and can be used as a null handle.
 */
 typedef hash_t Entity;
 
+#define ENTITY_INDEX_BITS 24
+#define ENTITY_INDEX_MASK ((1u << ENTITY_INDEX_BITS) - 1)
+#define ENTITY_MAX_GENERATION (UINT32_MAX >> ENTITY_INDEX_BITS)
+
+#define ENTITY_INDEX(e) ((e) & ENTITY_INDEX_MASK)
+#define ENTITY_GENERATION(e) ((e) >> ENTITY_INDEX_BITS)
+#define ENTITY_MAKE(idx, gen) (((hash_t)(gen) << ENTITY_INDEX_BITS) | ((idx) & ENTITY_INDEX_MASK))
+
 /*
     Information about a collection of components, called an Archetype. Systems
     operate on these, and they are used as a fast way to create entities with a
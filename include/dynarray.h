@@ -25,7 +25,8 @@ bool dyn_alloc(dynarray_t *arr, size_t size, size_t entry_size);
 void dyn_free(dynarray_t *arr);
 
 /*
-	Add a new item to the end of the array.
+	Add a new item to the end of the array. The capacity of the array doubles
+	whenever it runs out of space.
 */
 void* dyn_append(dynarray_t *arr, void *data);
 
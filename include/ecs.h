@@ -47,18 +47,62 @@ void ECS_Delete(ECS *ecs);
 */
 bool ECS_SetThreads(ECS *ecs, size_t threads);
 
+/*
+    The number of components of a single type to make room for.
+*/
+typedef struct {
+    hash_t type;
+    size_t count;
+} ECS_TypeCount;
+
+/*
+    Size the ECS's storage up front, e.g. before loading a level, so that
+    creating up to `entities` entities and the listed numbers of components
+    does not have to grow any tables.
+
+    `per_type_counts` is terminated by an entry with a type of 0, and may be
+    NULL. Storage for chunked components is sized per archetype and is not
+    reserved. Returns false without reserving anything if called from within
+    ECS_Update.
+*/
+bool ECS_Reserve(ECS *ecs, size_t entities, const ECS_TypeCount *per_type_counts);
+
 /*
     Run an update on all systems that need it.
 */
 void ECS_Update(ECS *ecs);
 
+/*
+    Command buffers record entity changes made during system updates. At the
+    end of ECS_Update, all buffers are played back and deleted; commands are
+    applied per entity, with only the last change to each component counting.
+
+    CommandBuffer_CreateEntity reserves the entity's ID right away, so it can
+    be used in other commands and buffers, but the entity only exists once the
+    buffer has been played back. Deleting a buffer discards its commands.
+
+    A command buffer belongs to the thread that created it, and must only be
+    used on that thread. Recording commands does not take any locks.
+*/
 CommandBuffer* CommandBuffer_New(ECS *ecs);
 void CommandBuffer_Delete(CommandBuffer *buff);
 
-hash_t CommandBuffer_CreateEntity(CommandBuffer *buff);
+Entity CommandBuffer_CreateEntity(CommandBuffer *buff);
 void CommandBuffer_DeleteEntity(CommandBuffer *buff, hash_t entity);
 
 void CommandBuffer_AddComponent(CommandBuffer *buff, hash_t entity, hash_t component);
 void CommandBuffer_RemoveComponent(CommandBuffer *buff, hash_t entity, hash_t component);
 
+/*
+    Add a component with its initial contents, copied from `data` (or zeroed
+    if `data` is NULL) into memory owned by the buffer. Playback copies the
+    contents into storage as-is instead of running the component's creation
+    function; if the entity already has the component, the old one is freed
+    and overwritten.
+
+    Returns the buffer's copy, which can still be modified until playback, or
+    NULL on failure.
+*/
+Component* CommandBuffer_AddComponentData(CommandBuffer *buff, hash_t entity, hash_t component, const void *data);
+
 #endif
@@ -7,6 +7,8 @@
 
 /*
 	Creates a new entity with a set of components.
+
+	Returns 0 if the entity could not be created.
 */
 Entity ECS_EntityNew(ECS *ecs, EntityArchetype *archetype);
 
@@ -16,7 +18,8 @@ Entity ECS_EntityNew(ECS *ecs, EntityArchetype *archetype);
 void ECS_EntityDelete(ECS *ecs, Entity entity);
 
 /*
-	Checks if the given entity exists.
+	Checks if the given entity exists. Returns false for handles to deleted
+	entities, even if their index has since been reused.
 */
 bool ECS_EntityExists(ECS *ecs, Entity entity);
 
@@ -53,12 +56,15 @@ inline ComponentID ECS_EntityGetComponentID(Entity entity, hash_t type)
 /*
 	Remove a component from the entity and free the component's data.
 */
-void ECS_EntityDeleteComponent(ECS *ecs, Entity entity, hash_t type);
+void ECS_EntityRemoveComponent(ECS *ecs, Entity entity, hash_t type);
 
 /* -------------------------------------------------------------------------- */
 
 /*
 	Registers and creates an entity archetype.
+
+	Component names may be wrapped in ComponentRead() or ComponentWrite() to
+	declare how systems using the archetype access them.
 */
 EntityArchetype* ECS_EntityRegisterArchetype(ECS *ecs, const char *name, const char** components);
 
@@ -5,7 +5,8 @@
 
 #include "ecs.h"
 
-typedef void EventData;
+// Event data up to this size is stored in the event itself.
+#define EVENT_INLINE_SIZE 48
 
 /*
     A structure representing an event sent to a system.
@@ -19,12 +20,33 @@ struct Event {
     EventData *data;
     // Whether the Event code should free the event's data.
     bool should_free;
+    // Whether the data is stored in `payload`. Copies of the event made with
+    // Event_Copy point at their own payload.
+    bool is_inline;
+    char payload[EVENT_INLINE_SIZE] __attribute__((aligned(8)));
 };
 
 /*
-    An Event Queue is a simple FIFO of Events.
+    Copy an event, keeping inline data pointing into the copy.
 */
-typedef dynarray_t EventQueue;
+void Event_Copy(Event *dst, const Event *src);
+
+/*
+    An Event Queue is a simple FIFO of Events, stored as a ring buffer with a
+    power of two capacity which grows as needed. `head` and `tail` only ever
+    increase, and are wrapped when accessing `events`.
+*/
+typedef struct {
+    Event *events;
+    size_t capacity;
+    size_t head;
+    size_t tail;
+} EventQueue;
+
+/*
+    Handles a batch of `count` consecutive events from a queue.
+*/
+typedef void (*event_drain_func)(Event *events, size_t count, void *udata);
 
 /*
     Allocate a new EventQueue.
@@ -36,6 +58,11 @@ EventQueue* EventQueue_New();
 */
 void EventQueue_Free(EventQueue *queue);
 
+/*
+    Return the number of events in the queue.
+*/
+size_t EventQueue_Size(EventQueue *queue);
+
 /*
     Return a pointer to an event in the queue. An index of 0 is the front
     of the queue.
@@ -55,6 +82,13 @@ bool EventQueue_Pop(EventQueue *queue, Event *out_event);
 */
 void EventQueue_Push(EventQueue *queue, Event *event);
 
+/*
+    Hand every event in the queue to `func`, in order and in as few calls as
+    possible, then remove them all as if by EventQueue_Clear. Returns the
+    number of events drained.
+*/
+size_t EventQueue_Drain(EventQueue *queue, event_drain_func func, void *udata);
+
 /*
     Remove all events from the queue.
 */
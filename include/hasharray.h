@@ -3,6 +3,8 @@
 #ifndef ECS_HASH_ARRAY_H
 #define ECS_HASH_ARRAY_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include "hash.h"
 
 /*
@@ -26,6 +28,12 @@ void ha_free(hasharray_t *ha);
 */
 void* ha_insert(hasharray_t *ha, hash_t idx, void *data);
 
+/*
+    Make room for indexes up to (but not including) `capacity` without
+    resizing the array again.
+*/
+bool ha_reserve(hasharray_t *ha, size_t capacity);
+
 /*
     Insert an element into the array at the first free index, optionally
     pre-filling it.
@@ -62,7 +70,7 @@ hash_t ha_first_free(hasharray_t *ha);
 hash_t ha_next_free(hasharray_t *ha, hash_t idx);
 
 /*
-    Get the index of the last filled slot in the array.
+    Get the index after the last filled slot in the array.
 */
 hash_t ha_last(hasharray_t *ha);
 
@@ -3,12 +3,17 @@
 #ifndef ECS_HASHTABLE_H
 #define ECS_HASHTABLE_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include "hash.h"
 
 /*
-    A hashtable implementation.
+    An open-addressing hashtable implementation, probed a group of slots at a
+    time. Values are stored in the slots, so inserting or deleting any entry
+    may move them: pointers returned by ht_insert and ht_get are only valid
+    until the table is next modified. Growing the index is spread out over
+    the inserts and deletes that follow it.
 
     Due to the use of an unsigned integer for the hash type, the index '0'
     does double-duty as both a regular index and an invalid index.
@@ -20,14 +25,23 @@ typedef struct hashtable_t hashtable_t;
 
 /*
 	Allocate and delete a hashtable.
-	The initial count of slots should be a power of two, and defaults to 16 if
-	not specified.
+	The table is sized to hold `count` entries before it needs to grow, and
+	holds at least 14 entries if not specified.
 
     Deletion of a hashtable is not thread safe.
 */
 hashtable_t* ht_alloc(const size_t count, const size_t val_size);
 void ht_free(hashtable_t* ht);
 
+/*
+	Make room for `count` entries, so that inserting up to that many entries
+	does not grow the table. Unlike regular growth, the index is rebuilt
+	right away.
+
+    This function is not thread safe.
+*/
+bool ht_reserve(hashtable_t *ht, size_t count);
+
 /*
 	Create / insert data into the hashtable at a certain index.
 	If data is NULL, zero-initializes the allocated memory.
@@ -56,8 +70,10 @@ size_t ht_len(hashtable_t *ht);
 	Get the next hashtable entry after the current key.
 	Returns NULL if the table has no more items.
 
-    This function has a best-case complexity of O(1) with a tightly packed
-    table, and a worst-case complexity of O(N).
+    Entries are visited in insertion order, not the order of their keys. This
+    function is O(1) for a tightly packed table, and O(N) if the current key
+    has been deleted or many entries after it have been. Prefer ht_iter_begin
+    and ht_iter_next when walking the whole table.
 
     This function does not modify the table and is thread-safe.
 */
@@ -86,6 +102,33 @@ hash_t ht_next_free(hashtable_t *ht, hash_t hash);
 */
 void ht_delete(hashtable_t *ht, hash_t hash);
 
+/*
+    A cursor over the entries of a hashtable, in insertion order. Unlike
+    ht_next, the cursor keeps its position rather than searching for the
+    current key again, and it also visits an entry with the key 0.
+
+    Entries may be deleted while iterating, but inserting into the table
+    invalidates the cursor. Deleting may move values, so `value` is only
+    valid until the next delete.
+
+    These functions do not modify the table and are thread-safe.
+*/
+typedef struct {
+    hashtable_t *ht;
+    size_t pos;
+    hash_t key;
+    void *value;
+} ht_iter_t;
+
+ht_iter_t ht_iter_begin(hashtable_t *ht);
+
+/*
+    Advance the cursor to the next entry and fill in its key and value.
+    Returns false once there are no entries left.
+*/
+bool ht_iter_next(ht_iter_t *iter);
+
+#define HT_ITER(HT, IT) for (ht_iter_t IT = ht_iter_begin(HT); ht_iter_next(&IT);)
 #define HT_FOR(HT) for (hash_t idx = 0; (idx = ht_next(HT, idx)) != 0;)
 #define HT_RANGE_FOR(HT, S, E) for (hash_t idx = S; (idx = ht_next(HT, idx)) != 0 && idx != E;)
 
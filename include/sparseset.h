@@ -0,0 +1,75 @@
+// sparseset.h - A sparse set implementation
+
+#ifndef ECS_SPARSESET_H
+#define ECS_SPARSESET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "hash.h"
+
+/*
+    A sparse set stores its entries in a packed (dense) array, alongside a
+    sparse table mapping each key to the entry's position in the dense array.
+
+    Lookup, insertion and deletion are O(1) and take at most two array
+    indexes, and iterating the set is a linear scan of the dense array.
+
+    Deletion moves the last entry of the set into the deleted slot, so
+    pointers to entries are invalidated by any insertion or deletion.
+
+    The sparse table is allocated in pages, but keys should be small
+    integers (e.g. entity indexes) to keep the table itself small.
+*/
+typedef struct sparseset_t sparseset_t;
+
+sparseset_t* ss_alloc(size_t num_entries, size_t entry_size);
+void ss_free(sparseset_t *ss);
+
+/*
+    Insert an element into the set at key, optionally pre-filling it with the
+    contents of data. If data is NULL, zero-initializes the entry.
+
+    Returns a pointer to the entry.
+*/
+void* ss_insert(sparseset_t *ss, hash_t key, void *data);
+
+/*
+    Make room for `capacity` entries in the dense arrays, so that the set
+    doesn't have to grow until it holds more than that.
+*/
+bool ss_reserve(sparseset_t *ss, size_t capacity);
+
+/*
+    Get a pointer to the element at key. Returns NULL if there is no element
+    present.
+*/
+void* ss_get(sparseset_t *ss, hash_t key);
+
+/*
+    Delete an element from the set.
+*/
+void ss_delete(sparseset_t *ss, hash_t key);
+
+/*
+    Returns the number of entries in the set.
+*/
+size_t ss_len(sparseset_t *ss);
+
+/*
+    Returns the dense arrays of keys and entries. Both arrays are ss_len()
+    entries long, and the key at position N belongs to the entry at
+    position N.
+*/
+hash_t* ss_keys(sparseset_t *ss);
+void* ss_data(sparseset_t *ss);
+
+/*
+    Iterate over all entries in the set.
+*/
+#define SS_FOR(ss, val) \
+    for (size_t idx = 0; idx < ss_len(ss) \
+        && ((val) = (void *)((char *)ss_data(ss) + idx * ss_entry_size(ss))); idx++)
+
+size_t ss_entry_size(sparseset_t *ss);
+
+#endif /* end of include guard: ECS_SPARSESET_H */
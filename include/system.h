@@ -14,6 +14,21 @@
 */
 typedef void (*system_update_func)(Entity ent, Component **comps, void *udata);
 
+/*
+    An alternative to system_update_func, which updates many entities per
+    call.
+
+    It is passed the number of entities to update, their IDs, and one array
+    per component in the system's archetype; comps[N] points to `count`
+    contiguous components of the Nth type, so the component of ents[I] is
+    at index I of each array.
+
+    Systems whose components are all ComponentStorageChunked are called once
+    per chunk. Other systems are called once per entity, with `count` set
+    to 1.
+*/
+typedef void (*system_batch_func)(size_t count, const Entity *ents, Component **comps, void *udata);
+
 /*
     This function is called when an event is sent to the system.
 
@@ -42,7 +57,7 @@ typedef struct {
     // thread.
     bool CreatesOrDeletesEntities;
 
-    // A NULL-terminated list of systems this system must run before.
+    // A NULL-terminated list of systems this system must run after.
     const char **AfterSystems;
 } SystemUpdateInfo;
 
@@ -59,6 +74,9 @@ typedef struct {
 
     system_update_func update;
     system_event_func event;
+
+    // If set, used instead of the update function.
+    system_batch_func batch;
 } SystemRegistryInfo;
 
 /*
@@ -78,9 +96,43 @@ void ECS_SystemUnregister(ECS *ecs, const char *name);
 /* -------------------------------------------------------------------------- */
 
 /*
-    Send an event to a system.
+    Send an event to a system. The event is delivered during the event phase
+    of the current update, or of the next one if it is sent while events are
+    being dispatched.
+
+    Any thread can send events at any time without taking a lock; events sent
+    from the same thread arrive in the order they were sent.
+
+    Returns false if there is no such system.
+*/
+bool ECS_SystemQueueEvent(ECS *ecs, const char *name, Event *event);
+
+/*
+    Give an event a copy of `data` (or zeroed data if NULL), without a heap
+    allocation of its own. Data up to EVENT_INLINE_SIZE bytes is stored in the
+    event itself, and bigger data in a per-thread arena which is reset once
+    the event has been dispatched, so handlers must not keep the pointer.
+
+    Events with data of their own must be sent with ECS_SystemQueueEvent or
+    ECS_PublishEvent. Returns the copied data, or NULL if out of memory.
+*/
+EventData* ECS_EventSetData(ECS *ecs, Event *event, const void *data, size_t size);
+
+/*
+    Subscribe a system to (or unsubscribe it from) the events with a given
+    id. Must not be called while the ECS is updating.
 */
-bool ECS_SystemQueueEvent(ECS *ecs, const char *name);
+bool ECS_SystemSubscribe(ECS *ecs, const char *name, hash_t event_id);
+void ECS_SystemUnsubscribe(ECS *ecs, const char *name, hash_t event_id);
+
+/*
+    Send an event to every system subscribed to its id, in the same way as
+    ECS_SystemQueueEvent. If the event owns its data, the data is shared by
+    the subscribers and freed after the event phase that dispatches it.
+
+    Returns the number of systems the event was sent to.
+*/
+size_t ECS_PublishEvent(ECS *ecs, Event *event);
 
 /* -------------------------------------------------------------------------- */
 
@@ -90,6 +142,9 @@ bool ECS_SystemQueueEvent(ECS *ecs, const char *name);
     SYSTEM() and SYSTEM_IMPL() declare a custom data struct for your system,
     which is registered with REGISTER_SYSTEM().
 
+    Systems declared with SYSTEM_BATCH_IMPL() implement T_batch() instead of
+    T_update(); see system_batch_func.
+
     REGISTER_SYSTEM_NO_UDATA() registers a system without any extra data.
 */
 #define SYSTEM(T) \
@@ -105,8 +160,24 @@ bool ECS_SystemQueueEvent(ECS *ecs, const char *name);
         #T, &T##_update_info, NULL, T##_uf, T##_ef \
     }; \
 
+#define SYSTEM_BATCH_IMPL(T) \
+    static inline void T##_batch(size_t n, const Entity *e, Component **c, T *p); \
+    static void T##_bf(size_t n, const Entity *e, Component **c, void *p) { T##_batch(n, e, c, (T *)p); }; \
+    static inline bool T##_event(Event *e, T *p); \
+    static bool T##_ef(Event *e, void *p) { return T##_event(e, (T *)p); }; \
+    const SystemUpdateInfo T##_update_info; \
+    SystemRegistryInfo T##_reg = { \
+        #T, &T##_update_info, NULL, NULL, T##_ef, T##_bf \
+    }; \
+
+/*
+    Declare how a system accesses the components in its archetype. Any number
+    of systems may read a component type at the same time, but a system
+    writing to it runs on its own. Plain component names count as writes.
+*/
+#define COMPONENT_READ_PREFIX "const "
 #define ComponentWrite(T) #T
-#define ComponentRead(T) #T
+#define ComponentRead(T) COMPONENT_READ_PREFIX #T
 
 #define REGISTER_SYSTEM(ECS, T, INST) \
     ECS_SystemRegister(ECS, &T##_reg, INST)
@@ -0,0 +1,308 @@
+// archetype.c - chunked component storage.
+
+#include "archetype.h"
+#include "manager.h"
+
+#define ALIGN8(size) (((size) + 7) & ~(size_t)7)
+
+static int compare_types(const void *a, const void *b)
+{
+	hash_t ha = (*(ComponentType **)a)->type_hash;
+	hash_t hb = (*(ComponentType **)b)->type_hash;
+	return ha < hb ? -1 : ha > hb;
+}
+
+void Archetype_SortTypes(ComponentType **types, uint32_t size)
+{
+	qsort(types, size, sizeof(ComponentType *), compare_types);
+}
+
+// Lay out the component arrays of a chunk holding `capacity` entities.
+// Returns the size of the chunk's data section.
+static size_t layout(Archetype *arch, uint32_t capacity)
+{
+	size_t offset = ALIGN8(sizeof(Entity) * capacity);
+	for (uint32_t col = 0; col < arch->size; col++) {
+		arch->offsets[col] = offset;
+		offset += ALIGN8(arch->types[col]->type_size * capacity);
+	}
+
+	return offset;
+}
+
+static hash_t archetype_hash(ComponentType **types, uint32_t size)
+{
+	hash_t hashes[size];
+	for (uint32_t idx = 0; idx < size; idx++) hashes[idx] = types[idx]->type_hash;
+
+	return hash_bytes((const char *)hashes, sizeof(hash_t) * size);
+}
+
+static bool archetype_matches(Archetype *arch, ComponentType **types, uint32_t size)
+{
+	if (arch->size != size) return false;
+	for (uint32_t idx = 0; idx < size; idx++) {
+		if (arch->types[idx] != types[idx]) return false;
+	}
+
+	return true;
+}
+
+static Archetype* archetype_new(ECS *ecs, hash_t id, ComponentType **types, uint32_t size)
+{
+	Archetype arch = {0};
+	arch.id = id;
+	arch.size = size;
+	arch.types = malloc(sizeof(ComponentType *) * size);
+	arch.offsets = malloc(sizeof(size_t) * size);
+	arch.edges = ht_alloc(8, sizeof(ArchetypeEdge));
+
+	if (!arch.types || !arch.offsets || !arch.edges
+		|| !dyn_alloc(&arch.chunks, 4, sizeof(Chunk *))) {
+		Archetype_Free(&arch);
+		return NULL;
+	}
+
+	memcpy(arch.types, types, sizeof(ComponentType *) * size);
+
+	// Fit as many entities in a chunk as we can, but always at least one.
+	size_t row_size = sizeof(Entity);
+	for (uint32_t col = 0; col < size; col++) row_size += types[col]->type_size;
+
+	uint32_t capacity = (CHUNK_SIZE - sizeof(Chunk)) / row_size;
+	while (capacity > 1 && sizeof(Chunk) + layout(&arch, capacity) > CHUNK_SIZE)
+		capacity--;
+	if (capacity < 1) capacity = 1;
+
+	arch.capacity = capacity;
+	arch.chunk_size = sizeof(Chunk) + layout(&arch, capacity);
+
+	// Archetypes are referenced from entities, edges and systems, so the
+	// table only holds pointers.
+	Archetype *ptr = malloc(sizeof(Archetype));
+	if (!ptr || !ht_insert(ecs->archetypes, id, &ptr)) {
+		free(ptr);
+		Archetype_Free(&arch);
+		return NULL;
+	}
+	*ptr = arch;
+
+	// Let systems iterating over chunks know about the new archetype.
+	Manager_ArchetypeCreated(ecs, ptr);
+
+	return ptr;
+}
+
+Archetype* Archetype_Get(ECS *ecs, ComponentType **types, uint32_t size)
+{
+	assert(ecs && ecs->archetypes);
+	if (size == 0) return NULL;
+
+	// Resolve (unlikely) hash collisions by probing the following IDs.
+	hash_t id = archetype_hash(types, size);
+	Archetype **arch;
+	while ((arch = ht_get(ecs->archetypes, id)) != NULL) {
+		if (archetype_matches(*arch, types, size)) return *arch;
+		id++;
+	}
+
+	return archetype_new(ecs, id, types, size);
+}
+
+Archetype* Archetype_With(ECS *ecs, Archetype *arch, ComponentType *type)
+{
+	assert(ecs && type);
+
+	if (!arch) return Archetype_Get(ecs, &type, 1);
+	if (Archetype_Column(arch, type->type_hash) >= 0) return arch;
+
+	ArchetypeEdge *edge = ht_get(arch->edges, type->type_hash);
+	if (edge && edge->add) return edge->add;
+
+	ComponentType *types[arch->size + 1];
+	memcpy(types, arch->types, sizeof(ComponentType *) * arch->size);
+	types[arch->size] = type;
+	Archetype_SortTypes(types, arch->size + 1);
+
+	Archetype *next = Archetype_Get(ecs, types, arch->size + 1);
+	if (!next) return NULL;
+
+	if (!edge) edge = ht_insert(arch->edges, type->type_hash, NULL);
+	if (edge) edge->add = next;
+
+	ArchetypeEdge *back = ht_get(next->edges, type->type_hash);
+	if (!back) back = ht_insert(next->edges, type->type_hash, NULL);
+	if (back) back->remove = arch;
+
+	return next;
+}
+
+Archetype* Archetype_Without(ECS *ecs, Archetype *arch, ComponentType *type)
+{
+	assert(ecs && type);
+
+	if (!arch) return NULL;
+	int col = Archetype_Column(arch, type->type_hash);
+	if (col < 0) return arch;
+	if (arch->size == 1) return NULL;
+
+	ArchetypeEdge *edge = ht_get(arch->edges, type->type_hash);
+	if (edge && edge->remove) return edge->remove;
+
+	// The type list is already sorted, so just skip the removed type.
+	ComponentType *types[arch->size - 1];
+	memcpy(types, arch->types, sizeof(ComponentType *) * col);
+	memcpy(types + col, arch->types + col + 1, sizeof(ComponentType *) * (arch->size - col - 1));
+
+	Archetype *prev = Archetype_Get(ecs, types, arch->size - 1);
+	if (!prev) return NULL;
+
+	if (!edge) edge = ht_insert(arch->edges, type->type_hash, NULL);
+	if (edge) edge->remove = prev;
+
+	ArchetypeEdge *back = ht_get(prev->edges, type->type_hash);
+	if (!back) back = ht_insert(prev->edges, type->type_hash, NULL);
+	if (back) back->add = arch;
+
+	return prev;
+}
+
+int Archetype_Column(Archetype *arch, hash_t type)
+{
+	// Binary search the sorted type list.
+	int lo = 0, hi = (int)arch->size - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		hash_t hash = arch->types[mid]->type_hash;
+		if (hash == type) return mid;
+		if (hash < type) lo = mid + 1;
+		else hi = mid - 1;
+	}
+
+	return -1;
+}
+
+bool Archetype_HasTypes(Archetype *arch, const hash_t *types, uint32_t size)
+{
+	for (uint32_t idx = 0; idx < size; idx++) {
+		if (Archetype_Column(arch, types[idx]) < 0) return false;
+	}
+
+	return true;
+}
+
+Component* Archetype_GetComponent(Archetype *arch, EntityRecord *rec, int col)
+{
+	assert(arch && rec && col >= 0 && (uint32_t)col < arch->size);
+
+	Chunk *chunk = CHUNK_GET(arch, rec->chunk);
+	return CHUNK_COLUMN(arch, chunk, col) + arch->types[col]->type_size * rec->row;
+}
+
+/* -------------------------------------------------------------------------- */
+
+// Reserve a row at the end of the archetype.
+static Chunk* push_row(ECS *ecs, Archetype *arch, Entity entity, EntityRecord *rec)
+{
+	Chunk *chunk = arch->chunks.size > 0 ? CHUNK_GET(arch, -1) : NULL;
+	if (!chunk || chunk->count == arch->capacity) {
+		chunk = malloc(arch->chunk_size);
+		ERR_OOM(chunk, "allocating archetype chunk");
+		chunk->count = 0;
+		if (!dyn_append(&arch->chunks, &chunk)) {
+			free(chunk);
+			return NULL;
+		}
+	}
+
+	rec->archetype = arch;
+	rec->chunk = arch->chunks.size - 1;
+	rec->row = chunk->count++;
+	arch->count++;
+
+	CHUNK_ENTITIES(chunk)[rec->row] = entity;
+	return chunk;
+}
+
+// Remove a row from the archetype, moving the last entity of the archetype
+// into the hole to keep the chunks packed.
+static void remove_row(ECS *ecs, Archetype *arch, EntityRecord *rec)
+{
+	Chunk *chunk = CHUNK_GET(arch, rec->chunk);
+	Chunk *last = CHUNK_GET(arch, -1);
+	uint32_t last_row = last->count - 1;
+
+	if (chunk != last || rec->row != last_row) {
+		Entity moved = CHUNK_ENTITIES(last)[last_row];
+		CHUNK_ENTITIES(chunk)[rec->row] = moved;
+
+		for (uint32_t col = 0; col < arch->size; col++) {
+			size_t size = arch->types[col]->type_size;
+			memcpy(CHUNK_COLUMN(arch, chunk, col) + size * rec->row,
+				CHUNK_COLUMN(arch, last, col) + size * last_row, size);
+		}
+
+		EntityRecord *moved_rec = Manager_GetEntity(ecs, moved);
+		assert(moved_rec);
+		moved_rec->chunk = rec->chunk;
+		moved_rec->row = rec->row;
+	}
+
+	last->count--;
+	arch->count--;
+
+	if (last->count == 0) {
+		free(last);
+		dyn_delete(&arch->chunks, -1);
+	}
+}
+
+bool Archetype_Move(ECS *ecs, Entity entity, EntityRecord *rec, Archetype *dst)
+{
+	assert(ecs && rec);
+
+	Archetype *src = rec->archetype;
+	if (src == dst) return true;
+
+	EntityRecord next = {0};
+	if (dst) {
+		Chunk *chunk = push_row(ecs, dst, entity, &next);
+		if (!chunk) return false;
+
+		// Both type lists are sorted, so walk them side by side.
+		uint32_t scol = 0;
+		for (uint32_t col = 0; col < dst->size; col++) {
+			ComponentType *type = dst->types[col];
+			char *ptr = CHUNK_COLUMN(dst, chunk, col) + type->type_size * next.row;
+
+			while (src && scol < src->size && src->types[scol]->type_hash < type->type_hash)
+				scol++;
+
+			if (src && scol < src->size && src->types[scol] == type)
+				memcpy(ptr, Archetype_GetComponent(src, rec, scol), type->type_size);
+			else
+				memset(ptr, 0, type->type_size);
+		}
+	}
+
+	if (src) remove_row(ecs, src, rec);
+
+	rec->archetype = next.archetype;
+	rec->chunk = next.chunk;
+	rec->row = next.row;
+	return true;
+}
+
+void Archetype_Free(Archetype *arch)
+{
+	assert(arch);
+
+	if (arch->chunks.ptr) {
+		DYN_FOR(arch->chunks, 0) free(CHUNK_GET(arch, idx));
+		dyn_free(&arch->chunks);
+	}
+
+	if (arch->edges) ht_free(arch->edges);
+	free(arch->types);
+	free(arch->offsets);
+}
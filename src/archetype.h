@@ -0,0 +1,130 @@
+// archetype.h - chunked component storage.
+
+#ifndef ECS_ARCHETYPE_H
+#define ECS_ARCHETYPE_H
+
+#include "core.h"
+
+/*
+	Components registered with ComponentStorageChunked are not stored in a
+	per-type table. Instead, every entity is placed in the Archetype matching
+	the exact set of chunked components attached to it, and the archetype
+	stores its entities in fixed-size Chunks.
+
+	Inside a chunk, each component type has its own contiguous array, preceded
+	by an array of the IDs of the entities stored in the chunk:
+
+	struct chunk {
+		uint32_t count;
+		Entity entities[capacity];
+		TypeA a[capacity];
+		TypeB b[capacity];
+		...
+	}
+
+	Chunks are always packed; removing an entity moves the last entity of the
+	archetype into the freed row. As a consequence, pointers to chunked
+	components are invalidated by any structural change to the archetype.
+
+	Note that an Archetype is unrelated to the user-facing EntityArchetype,
+	which is simply a named list of component types.
+*/
+
+// The default size of a single chunk in bytes.
+#define CHUNK_SIZE 16384
+
+typedef struct ComponentType ComponentType;
+typedef struct Archetype Archetype;
+typedef struct EntityRecord EntityRecord;
+
+typedef struct {
+	uint32_t count;
+	// Aligned to the 8-byte boundary, like the mempool.
+	char data[] __attribute__((aligned(8)));
+} Chunk;
+
+/*
+	Cached transitions to the archetypes with one component type more or less
+	than the current one.
+*/
+typedef struct {
+	Archetype *add;
+	Archetype *remove;
+} ArchetypeEdge;
+
+struct Archetype {
+	hash_t id;
+
+	// The component types stored in this archetype, sorted by type hash.
+	uint32_t size;
+	ComponentType **types;
+	// The offset of each component array from the start of Chunk::data.
+	size_t *offsets;
+
+	// The number of entities a single chunk can hold, and its size in bytes.
+	uint32_t capacity;
+	size_t chunk_size;
+
+	// The total number of entities stored in this archetype.
+	size_t count;
+	dynarray_t chunks;
+
+	// component type hash -> ArchetypeEdge
+	hashtable_t *edges;
+};
+
+#define CHUNK_GET(arch, idx) (*(Chunk **)dyn_get(&(arch)->chunks, idx))
+#define CHUNK_ENTITIES(chunk) ((Entity *)(chunk)->data)
+#define CHUNK_COLUMN(arch, chunk, col) ((chunk)->data + (arch)->offsets[col])
+
+/*
+	Get or create the archetype storing exactly the passed set of component
+	types. `types` must be sorted with Archetype_SortTypes.
+
+	Returns NULL if `size` is 0; entities without chunked components are not
+	stored in an archetype.
+*/
+Archetype* Archetype_Get(ECS *ecs, ComponentType **types, uint32_t size);
+
+/*
+	Get the archetype with (or without) an additional component type, using
+	the cached edges of the archetype where possible. `arch` may be NULL.
+*/
+Archetype* Archetype_With(ECS *ecs, Archetype *arch, ComponentType *type);
+Archetype* Archetype_Without(ECS *ecs, Archetype *arch, ComponentType *type);
+
+void Archetype_SortTypes(ComponentType **types, uint32_t size);
+
+/*
+	Returns the column of a component type in the archetype, or -1 if the
+	archetype does not store that type.
+*/
+int Archetype_Column(Archetype *arch, hash_t type);
+
+/*
+	Returns whether the archetype stores every type in the list.
+*/
+bool Archetype_HasTypes(Archetype *arch, const hash_t *types, uint32_t size);
+
+/*
+	Get a component stored in the archetype.
+*/
+Component* Archetype_GetComponent(Archetype *arch, EntityRecord *rec, int col);
+
+/*
+	Move an entity from its current archetype to `dst`, copying all components
+	present in both archetypes. Components that are only present in `dst` are
+	zero-initialized; components only present in the source archetype are
+	dropped, so the caller must run their deletion functions beforehand.
+
+	Either the source or the destination archetype may be NULL.
+*/
+bool Archetype_Move(ECS *ecs, Entity entity, EntityRecord *rec, Archetype *dst);
+
+/*
+	Free all chunks and bookkeeping of an archetype. Does not run component
+	deletion functions.
+*/
+void Archetype_Free(Archetype *arch);
+
+#endif /* end of include guard: ECS_ARCHETYPE_H */
@@ -0,0 +1,65 @@
+// arena.c
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "arena.h"
+
+#define ALIGN8(size) (((size) + 7) & ~(size_t)7)
+
+void arena_init(Arena *arena, size_t block_size)
+{
+    assert(arena);
+
+    arena->blocks = NULL;
+    arena->block_size = block_size ? block_size : ARENA_BLOCK_SIZE;
+}
+
+void* arena_alloc(Arena *arena, size_t size)
+{
+    assert(arena);
+
+    // Even empty allocations get their own byte, so they have an address.
+    size = ALIGN8(size ? size : 1);
+
+    ArenaBlock *block = arena->blocks;
+    if (!block || block->size - block->used < size) {
+        size_t block_size = size > arena->block_size ? size : arena->block_size;
+        block = malloc(sizeof(ArenaBlock) + block_size);
+        if (!block) return NULL;
+
+        block->next = arena->blocks;
+        block->size = block_size;
+        block->used = 0;
+        arena->blocks = block;
+    }
+
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+void arena_reset(Arena *arena)
+{
+    assert(arena);
+    if (!arena->blocks) return;
+
+    ArenaBlock *block = arena->blocks->next;
+    while (block) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+
+    arena->blocks->next = NULL;
+    arena->blocks->used = 0;
+}
+
+void arena_free(Arena *arena)
+{
+    assert(arena);
+
+    arena_reset(arena);
+    free(arena->blocks);
+    arena->blocks = NULL;
+}
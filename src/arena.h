@@ -0,0 +1,55 @@
+// arena.h - bump allocation from a list of blocks.
+
+#ifndef ECS_ARENA_H
+#define ECS_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+    An arena hands out memory by bumping an offset into its current block,
+    and grabs a new block once that one is full. Allocations can't be freed
+    one by one; instead, the whole arena is reset or freed at once. Memory
+    handed out stays in place until then.
+
+    Allocations are aligned to 8 bytes. Arenas are not thread safe.
+*/
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+    char data[] __attribute__((aligned(8)));
+} ArenaBlock;
+
+typedef struct {
+    // The current block, followed by the older ones.
+    ArenaBlock *blocks;
+    size_t block_size;
+} Arena;
+
+// The default size of an arena block in bytes.
+#define ARENA_BLOCK_SIZE 4096
+
+/*
+    Initialize an empty arena. Blocks are only allocated once needed; a
+    block_size of 0 selects ARENA_BLOCK_SIZE.
+*/
+void arena_init(Arena *arena, size_t block_size);
+
+/*
+    Allocate `size` bytes from the arena. Allocations bigger than the block
+    size get a block of their own. Returns NULL if out of memory.
+*/
+void* arena_alloc(Arena *arena, size_t size);
+
+/*
+    Forget every allocation, keeping only the current block around for reuse.
+*/
+void arena_reset(Arena *arena);
+
+/*
+    Free all blocks of the arena.
+*/
+void arena_free(Arena *arena);
+
+#endif /* end of include guard: ECS_ARENA_H */
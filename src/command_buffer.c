@@ -4,65 +4,427 @@
 
 CommandBuffer* CommandBuffer_New(ECS *ecs)
 {
-    hash_t id;
-    ECS_ATOMIC(ecs, CommandBuffer *buff = ha_insert_free(ecs->buffers, &id, NULL));
+    assert(ecs);
+
+    // Worker threads keep their own buffers, so nothing here needs a lock.
+    ThreadData *thread = ECS_CurrentThread();
+    dynarray_t *owner = thread ? &thread->buffers : &ecs->buffers;
+
+    CommandBuffer *buff = malloc(sizeof(CommandBuffer));
     if (!buff) return NULL;
 
     buff->ecs = ecs;
-    buff->id = id;
-    buff->last_entity = 0;
-    dyn_alloc(&buff->commands, 16, sizeof(Command));
-    pthread_mutex_init(&buff->mutex, NULL);
+    buff->owner = owner;
+    arena_init(&buff->arena, 0);
+    if (!dyn_alloc(&buff->commands, 16, sizeof(Command)) || !dyn_append(owner, &buff)) {
+        CommandBuffer_Free(buff);
+        return NULL;
+    }
 
     return buff;
 }
 
+void CommandBuffer_Free(CommandBuffer *buff)
+{
+    arena_free(&buff->arena);
+    dyn_free(&buff->commands);
+    free(buff);
+}
+
 void CommandBuffer_Delete(CommandBuffer *buff)
 {
     if (!buff) return;
-    ECS *ecs = buff->ecs;
 
-    ECS_LOCK(ecs);
-    pthread_mutex_destroy(&buff->mutex);
-    dyn_free(&buff->commands);
-    ha_delete(ecs->buffers, buff->id);
-    ECS_UNLOCK(ecs);
+    // The IDs of the entities the buffer created have already been handed
+    // out, so the buffer stays around to release them during playback. Each
+    // creation is kept and paired with a deletion, which playback treats as
+    // a cancelled entity and gives the reserved ID back.
+    size_t size = 0;
+    for (size_t idx = 0; idx < buff->commands.size; idx++) {
+        Command *cm = dyn_get(&buff->commands, idx);
+        if (cm->type != CMD_EntityCreate) continue;
+
+        Command *dst = dyn_get(&buff->commands, size++);
+        *dst = (Command){ CMD_EntityCreate, {cm->data[0], 0}, NULL };
+    }
+    buff->commands.size = size;
+
+    for (size_t idx = 0; idx < size; idx++) {
+        Command cm = { CMD_EntityDelete, {((Command *)dyn_get(&buff->commands, idx))->data[0], 0}, NULL };
+        dyn_append(&buff->commands, &cm);
+    }
+
+    if (size == 0) {
+        int idx = dyn_find(buff->owner, &buff);
+        if (idx >= 0) dyn_remove(buff->owner, idx, true);
+        CommandBuffer_Free(buff);
+    }
 }
 
 static inline void insert(CommandBuffer *buff, Command *cm)
 {
-    CB_ATOMIC(buff, dyn_append(&buff->commands, cm));
+    dyn_append(&buff->commands, cm);
 }
 
-hash_t CommandBuffer_CreateEntity(CommandBuffer *buff)
+Entity CommandBuffer_CreateEntity(CommandBuffer *buff)
 {
     assert(buff);
 
-    Command cm = { CMD_EntityCreate, {buff->last_entity++, 0} };
+    // The entity gets its final ID right away, so it can be referred to
+    // anywhere before it is created.
+    Entity entity = Manager_ReserveEntity(buff->ecs);
+    if (!entity) return 0;
+
+    Command cm = { CMD_EntityCreate, {entity, 0}, NULL };
 
     insert(buff, &cm);
-    return cm.data[0];
+    return entity;
 }
 
 void CommandBuffer_AddComponent(CommandBuffer *buff, hash_t entity, hash_t component)
 {
     assert(buff);
 
-    Command cm = { CMD_ComponentAttach, {entity, component} };
+    Command cm = { CMD_ComponentAttach, {entity, component}, NULL };
     insert(buff, &cm);
 }
 
+Component* CommandBuffer_AddComponentData(CommandBuffer *buff, hash_t entity, hash_t component, const void *data)
+{
+    assert(buff);
+
+    ComponentType *type = Manager_GetComponentType(buff->ecs, component);
+    ERR_RET_NULL(type, "Error recording command: unknown component type %08x.\n", component);
+
+    // Storage copies at least one byte, even for empty components, which
+    // the arena's allocations always have.
+    void *payload = arena_alloc(&buff->arena, type->type_size);
+    ERR_OOM(payload, "recording component data");
+
+    if (data)
+        memcpy(payload, data, type->type_size);
+    else
+        memset(payload, 0, type->type_size);
+
+    Command cm = { CMD_ComponentAttach, {entity, component}, payload };
+    insert(buff, &cm);
+    return payload;
+}
+
 void CommandBuffer_RemoveComponent(CommandBuffer *buff, hash_t entity, hash_t component)
 {
     assert(buff);
 
-    Command cm = { CMD_ComponentDetach, {entity, component} };
+    Command cm = { CMD_ComponentDetach, {entity, component}, NULL };
     insert(buff, &cm);
 }
 
 void CommandBuffer_DeleteEntity(CommandBuffer *buff, hash_t entity)
 {
     assert(buff);
-    Command cm = { CMD_EntityDelete, {entity, 0} };
+    Command cm = { CMD_EntityDelete, {entity, 0}, NULL };
     insert(buff, &cm);
 }
+
+/* -------------------------------------------------------------------------- */
+
+/*
+    Playback gathers the commands of all buffers, and sorts them by entity so
+    all commands affecting an entity are next to each other, in the order
+    they were recorded. Each entity's commands are then coalesced into at
+    most one creation or deletion and one change per component type.
+
+    Creations and deletions are applied first, in entity order. The changes
+    to components that aren't chunked are then partitioned by component type,
+    and each partition is applied to its type's storage on the threads. The
+    entity signatures, archetype moves and system collections are shared
+    between types, so they are updated afterwards on the main thread.
+*/
+typedef struct {
+    uint32_t seq;
+    Command cmd;
+} PlaybackCommand;
+
+typedef struct {
+    Entity entity;
+    ComponentType *type;
+    const void *payload;
+    bool attach;
+    // Set by the partition's task if the component was created or deleted.
+    bool changed;
+} PlaybackChange;
+
+typedef struct {
+    PlaybackChange *changes;
+    // The unchunked changes, grouped by type, and where each group starts.
+    uint32_t *order;
+    uint32_t *parts;
+} PlaybackPartitions;
+
+static int compare_playback(const void *a, const void *b)
+{
+    const PlaybackCommand *ca = a, *cb = b;
+    if (ca->cmd.data[0] != cb->cmd.data[0]) return ca->cmd.data[0] < cb->cmd.data[0] ? -1 : 1;
+    return ca->seq < cb->seq ? -1 : ca->seq > cb->seq;
+}
+
+// Sort component changes by type, keeping the recording order.
+static int compare_changes(const void *a, const void *b)
+{
+    const PlaybackCommand *ca = *(PlaybackCommand **)a, *cb = *(PlaybackCommand **)b;
+    if (ca->cmd.data[1] != cb->cmd.data[1]) return ca->cmd.data[1] < cb->cmd.data[1] ? -1 : 1;
+    return ca->seq < cb->seq ? -1 : ca->seq > cb->seq;
+}
+
+// Create or delete an entity, and append its remaining component changes.
+static void playback_entity(ECS *ecs, PlaybackCommand *cmds, size_t count,
+    PlaybackChange *out, size_t *num_out)
+{
+    Entity entity = cmds[0].cmd.data[0];
+    bool create = false, destroy = false;
+
+    PlaybackCommand *changes[count];
+    size_t num_changes = 0;
+
+    for (size_t idx = 0; idx < count; idx++) {
+        switch (cmds[idx].cmd.type) {
+        case CMD_EntityCreate:
+            create = true;
+            break;
+        case CMD_EntityDelete:
+            destroy = true;
+            break;
+        default:
+            // Changes made after deleting the entity don't matter.
+            if (!destroy) changes[num_changes++] = &cmds[idx];
+            break;
+        }
+    }
+
+    // Entities created and deleted in the same update cancel out, but their
+    // reserved IDs still need to be given back.
+    if (create && destroy) {
+        Manager_ReleaseEntity(ecs, entity);
+        return;
+    }
+
+    if (destroy) {
+        ECS_EntityDelete(ecs, entity);
+        return;
+    }
+
+    if (create && !Manager_CreateReservedEntity(ecs, entity)) {
+        ECS_ERROR(ecs, "Error creating deferred entity %08x.", entity);
+        return;
+    }
+
+    // Commands for entities deleted in the meantime are dropped.
+    if (num_changes == 0 || !Manager_GetEntity(ecs, entity)) return;
+
+    // Only the last change to each component type counts.
+    qsort(changes, num_changes, sizeof(PlaybackCommand *), compare_changes);
+
+    for (size_t idx = 0; idx < num_changes; idx++) {
+        Command *cm = &changes[idx]->cmd;
+        if (idx + 1 < num_changes && changes[idx + 1]->cmd.data[1] == cm->data[1]) continue;
+
+        ComponentType *type = Manager_GetComponentType(ecs, cm->data[1]);
+        ERR_CONTINUE(type, "Error playing back command buffer: unknown component type %08x.\n", cm->data[1]);
+
+        out[(*num_out)++] = (PlaybackChange){
+            entity, type, cm->payload, cm->type == CMD_ComponentAttach, false
+        };
+    }
+}
+
+// Apply the changes to a single component type's storage.
+static void playback_partition(ECS *ecs, size_t part, void *udata)
+{
+    PlaybackPartitions *data = udata;
+
+    for (uint32_t idx = data->parts[part]; idx < data->parts[part + 1]; idx++) {
+        PlaybackChange *ch = &data->changes[data->order[idx]];
+        ComponentType *type = ch->type;
+        Component *comp = Manager_GetComponent(ecs, type, ch->entity);
+
+        if (!ch->attach) {
+            Manager_UnstoreComponent(type, ch->entity);
+            ch->changed = comp != NULL;
+        }
+        else if (!comp) {
+            ch->changed = Manager_StoreComponent(type, ch->entity, ch->payload) != NULL;
+        }
+        else if (ch->payload) {
+            // Existing components are only overwritten when given new contents.
+            if (type->dl_func) type->dl_func(comp);
+            memcpy(comp, ch->payload, type->type_size);
+        }
+    }
+}
+
+// Split the unchunked changes by component type, with a counting sort on
+// the type index. Returns the number of partitions.
+static size_t partition_changes(ECS *ecs, PlaybackPartitions *data, size_t count)
+{
+    size_t num_types = ecs->type_list.size;
+    uint32_t starts[num_types + 1];
+    memset(starts, 0, sizeof(starts));
+
+    for (size_t idx = 0; idx < count; idx++) {
+        ComponentType *type = data->changes[idx].type;
+        if (type->storage != ComponentStorageChunked) starts[type->type_idx + 1]++;
+    }
+
+    size_t num_parts = 0;
+    for (size_t idx = 0; idx < num_types; idx++) {
+        if (starts[idx + 1] > 0) data->parts[num_parts++] = starts[idx];
+        starts[idx + 1] += starts[idx];
+    }
+    data->parts[num_parts] = starts[num_types];
+
+    // Entities stay sorted inside each partition.
+    for (size_t idx = 0; idx < count; idx++) {
+        ComponentType *type = data->changes[idx].type;
+        if (type->storage != ComponentStorageChunked) data->order[starts[type->type_idx]++] = idx;
+    }
+
+    return num_parts;
+}
+
+// Apply the chunked changes of an entity, and update its collections.
+static void finish_entity(ECS *ecs, PlaybackChange *changes, size_t count)
+{
+    Entity entity = changes[0].entity;
+    ComponentType *add[count], *remove[count];
+    const void *add_data[count];
+    uint32_t num_add = 0, num_remove = 0;
+
+    for (size_t idx = 0; idx < count; idx++) {
+        PlaybackChange *ch = &changes[idx];
+        if (ch->type->storage != ComponentStorageChunked) continue;
+
+        if (ch->attach) {
+            add_data[num_add] = ch->payload;
+            add[num_add++] = ch->type;
+        }
+        else {
+            remove[num_remove++] = ch->type;
+        }
+    }
+
+    if ((num_add || num_remove)
+        && !Manager_ApplyComponents(ecs, entity, add, add_data, num_add, remove, num_remove))
+        ECS_ERROR(ecs, "Error playing back commands for entity %08x.", entity);
+
+    for (size_t idx = 0; idx < count; idx++) {
+        if (changes[idx].changed) Manager_UpdateCollections(ecs, entity, changes[idx].type);
+    }
+}
+
+static void playback_changes(ECS *ecs, PlaybackChange *changes, size_t count)
+{
+    PlaybackPartitions data = {
+        changes,
+        malloc(sizeof(uint32_t) * count),
+        malloc(sizeof(uint32_t) * (ecs->type_list.size + 1))
+    };
+
+    if (!data.order || !data.parts) {
+        free(data.order);
+        free(data.parts);
+        ERR_RET(false, "Error playing back command buffers: out of memory.\n");
+    }
+
+    ECS_RunTasks(ecs, partition_changes(ecs, &data, count), playback_partition, &data);
+    free(data.order);
+    free(data.parts);
+
+    for (size_t idx = 0; idx < count; idx++) {
+        PlaybackChange *ch = &changes[idx];
+        if (!ch->changed) continue;
+
+        bitset_t *signature = Manager_EntitySignature(ecs, ch->entity);
+        if (ch->attach)
+            bs_set(signature, ch->type->type_idx);
+        else
+            bs_clear(signature, ch->type->type_idx);
+    }
+
+    for (size_t start = 0, end = 0; start < count; start = end) {
+        while (end < count && changes[end].entity == changes[start].entity) end++;
+        finish_entity(ecs, &changes[start], end - start);
+    }
+}
+
+// Gather the commands of a list of buffers.
+static void gather_buffers(dynarray_t *buffers, PlaybackCommand *cmds, size_t *num)
+{
+    DYN_FOR(*buffers, 0) {
+        CommandBuffer *buff = *(CommandBuffer **)dyn_get(buffers, idx);
+
+        for (size_t cm_idx = 0; cm_idx < buff->commands.size; cm_idx++, (*num)++) {
+            cmds[*num].seq = *num;
+            cmds[*num].cmd = *(Command *)dyn_get(&buff->commands, cm_idx);
+        }
+    }
+}
+
+// The payloads of the commands live in the buffers, so they are only freed
+// once everything has been played back.
+static void free_buffers(dynarray_t *buffers)
+{
+    DYN_FOR(*buffers, 0) CommandBuffer_Free(*(CommandBuffer **)dyn_get(buffers, idx));
+    buffers->size = 0;
+}
+
+static size_t count_commands(dynarray_t *buffers)
+{
+    size_t count = 0;
+    DYN_FOR(*buffers, 0) count += (*(CommandBuffer **)dyn_get(buffers, idx))->commands.size;
+    return count;
+}
+
+void ECS_ResolveCommandBuffers(ECS *ecs)
+{
+    assert(ecs);
+
+    // The threads' buffers are merged with the main thread's.
+    size_t count = count_commands(&ecs->buffers);
+    for (size_t idx = 0; idx < ecs->num_threads; idx++)
+        count += count_commands(&ecs->threads[idx]->buffers);
+
+    // Buffers without any commands only need to be freed.
+    PlaybackCommand *cmds = NULL;
+    PlaybackChange *changes = NULL;
+    if (count > 0) {
+        cmds = malloc(sizeof(PlaybackCommand) * count);
+        changes = malloc(sizeof(PlaybackChange) * count);
+        if (!cmds || !changes) {
+            free(cmds);
+            free(changes);
+            ERR_RET(false, "Error playing back command buffers: out of memory.\n");
+        }
+    }
+
+    size_t num = 0;
+    gather_buffers(&ecs->buffers, cmds, &num);
+    for (size_t idx = 0; idx < ecs->num_threads; idx++)
+        gather_buffers(&ecs->threads[idx]->buffers, cmds, &num);
+
+    if (count > 0) qsort(cmds, count, sizeof(PlaybackCommand), compare_playback);
+
+    size_t num_changes = 0;
+    for (size_t start = 0, end = 0; start < count; start = end) {
+        while (end < count && cmds[end].cmd.data[0] == cmds[start].cmd.data[0]) end++;
+        playback_entity(ecs, &cmds[start], end - start, changes, &num_changes);
+    }
+
+    if (num_changes > 0) playback_changes(ecs, changes, num_changes);
+
+    free_buffers(&ecs->buffers);
+    for (size_t idx = 0; idx < ecs->num_threads; idx++)
+        free_buffers(&ecs->threads[idx]->buffers);
+
+    free(cmds);
+    free(changes);
+}
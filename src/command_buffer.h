@@ -1,6 +1,7 @@
 // command_buffer.h
 
 #include "core.h"
+#include "arena.h"
 
 typedef enum {
     CMD_EntityCreate,
@@ -12,16 +13,25 @@ typedef enum {
 typedef struct {
     Command_T type;
     hash_t data[2];
+    // The initial contents of an attached component, or NULL.
+    const void *payload;
 } Command;
 
+/*
+    Command buffers belong to the thread that created them, and are kept in
+    that thread's list of buffers (ThreadData::buffers, or ECS::buffers for
+    the main thread). Only the owning thread records commands into a buffer,
+    so recording is a plain append without any locking.
+*/
 struct CommandBuffer {
 	ECS *ecs;
-    hash_t id;
-    hash_t last_entity;
-    pthread_mutex_t mutex;
+    // The list of buffers of the owning thread.
+    dynarray_t *owner;
     dynarray_t commands;
+    // Component payloads, which stay in place until the buffer is freed
+    // after playback.
+    Arena arena;
 };
 
-#define CB_LOCK(cb) pthread_mutex_lock(&cb->mutex)
-#define CB_UNLOCK(cb) pthread_mutex_unlock(&cb->mutex)
-#define CB_ATOMIC(cb, op) CB_LOCK(cb); op; CB_UNLOCK(cb)
+// Free a command buffer without removing it from its owner's list.
+void CommandBuffer_Free(CommandBuffer *buff);
@@ -6,7 +6,7 @@
 const char* ECS_ComponentToString(ECS *ecs, ComponentID comp)
 {
 	assert(ecs && ecs->cm_types);
-	ComponentType *type = ht_get(ecs->cm_types, comp.type);
+	ComponentType *type = Manager_GetComponentType(ecs, comp.type);
 	if (!type) return NULL;
 
 	char *str = malloc(strlen(type->type) + 12);
@@ -32,10 +32,12 @@ bool ECS_ComponentRegisterType(ECS *ecs, const ComponentRegistry *reg)
 	}
 
 	ComponentType c_type = {
-		malloc(strlen(type) + 1),
-		reg->cr_func, reg->dl_func,
-		reg->size,
-		hash_string(type)
+		.type = malloc(strlen(type) + 1),
+		.cr_func = reg->cr_func,
+		.dl_func = reg->dl_func,
+		.type_size = reg->size,
+		.type_hash = hash_string(type),
+		.storage = reg->storage
 	};
 
 	strcpy((char *)c_type.type, type);
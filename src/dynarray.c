@@ -13,6 +13,17 @@ static inline int clamp(int val, int min, int max)
 
 #define GET_RIDX(size, idx) (idx) < 0 ? clamp((size) + (idx), 0, (size)) : (idx)
 
+// Make room for at least `size` items, doubling the capacity when it grows so
+// that appending is amortized O(1).
+static bool grow(dynarray_t *arr, size_t size)
+{
+	if (size <= arr->capacity) return true;
+
+	size_t newcap = arr->capacity * 2;
+	if (newcap < size) newcap = size;
+	return dyn_resize(arr, newcap);
+}
+
 bool dyn_alloc(dynarray_t *arr, size_t size, size_t entry_size)
 {
 	assert(arr);
@@ -36,14 +47,14 @@ void* dyn_insert(dynarray_t *arr, int idx, void *data)
 	assert(arr && arr->ptr);
 
 	const size_t r_idx = GET_RIDX(arr->size, idx);
-	ERR_RET_NULL(dyn_resize(arr, (r_idx < arr->size ? arr->size : r_idx) + 1), "Error resizing dynamic array.");
+	ERR_RET_NULL(grow(arr, (r_idx < arr->size ? arr->size : r_idx) + 1), "Error resizing dynamic array.");
 
 	void *ptr = arr->ptr + arr->entry_size * r_idx;
 
+	// Shift the following items up by one in a single move.
 	if (r_idx < arr->size) {
+		memmove(ptr + arr->entry_size, ptr, arr->entry_size * (arr->size - r_idx));
 		arr->size++;
-		for (size_t idx = r_idx + 1; idx < arr->size; idx++)
-			dyn_swap(arr, idx - 1, idx);
 	}
 
 	if (data == NULL) memset(ptr, 0, arr->entry_size);
@@ -60,7 +71,7 @@ void* dyn_append(dynarray_t *arr, void *data)
 {
 	assert(arr && arr->ptr);
 
-	ERR_RET_NULL(dyn_resize(arr, arr->size + 1), "Error resizing dynamic array.");
+	ERR_RET_NULL(grow(arr, arr->size + 1), "Error resizing dynamic array.");
 
 	void *ptr = arr->ptr + arr->entry_size * arr->size++;
 	if (data == NULL) memset(ptr, 0, arr->entry_size);
@@ -114,10 +125,9 @@ void dyn_remove(dynarray_t *arr, int idx, bool just_swap)
 	if (just_swap) {
 		dyn_swap(arr, r_idx, -1);
 	}
-	else {
-		for (size_t idx = r_idx+1; idx < arr->size; idx++) {
-			dyn_swap(arr, r_idx-1, idx);
-		}
+	else if (r_idx < arr->size) {
+		void *ptr = arr->ptr + r_idx * arr->entry_size;
+		memmove(ptr, ptr + arr->entry_size, arr->entry_size * (arr->size - r_idx - 1));
 	}
 
 	dyn_delete(arr, -1);
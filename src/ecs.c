@@ -25,25 +25,34 @@ ECS* ECS_CustomNew(const ECS_AllocInfo *alloc)
 
 	assert(alloc);
 
-	ECS *ecs = malloc(sizeof(ECS));
+	ECS *ecs = calloc(1, sizeof(ECS));
 	if (!ecs) return NULL;
 
-	_ERR(ecs->entities = ha_alloc(alloc->entities, sizeof(Entity)));
+	_ERR(Manager_InitEntities(ecs, alloc->entities));
 
-	_ERR(ecs->systems = ht_alloc(alloc->systems, sizeof(System)));
+	_ERR(ecs->systems = ht_alloc(alloc->systems, sizeof(System *)));
 	_ERR(dyn_alloc(&ecs->system_order, alloc->systems, sizeof(System *)));
 	_ERR(dyn_alloc(&ecs->update_systems, alloc->systems, sizeof(SystemQueueItem)));
+	_ERR(dyn_alloc(&ecs->schedule, alloc->systems, sizeof(ScheduleNode)));
+	_ERR(dyn_alloc(&ecs->schedule_edges, alloc->systems, sizeof(uint32_t)));
+	_ERR(dyn_alloc(&ecs->main_queue, alloc->systems, sizeof(uint32_t)));
 
-	_ERR(ecs->cm_types = ht_alloc(alloc->cm_types, sizeof(ComponentType)));
+	_ERR(ecs->cm_types = ht_alloc(alloc->cm_types, sizeof(ComponentType *)));
+	_ERR(dyn_alloc(&ecs->type_list, alloc->cm_types, sizeof(ComponentType *)));
+	_ERR(ecs->archetypes = ht_alloc(alloc->cm_types, sizeof(Archetype *)));
 
 	ecs->alloc_info = *alloc;
 	ecs->num_threads = 0;
-	ecs->ready_threads = 0;
 	ecs->threads = NULL;
-	_ERR(ecs->buffers = ha_alloc(4, sizeof(CommandBuffer)));
+	_ERR(dyn_alloc(&ecs->buffers, 4, sizeof(CommandBuffer *)));
+	_ERR(ecs->subscriptions = ht_alloc(alloc->systems, sizeof(dynarray_t)));
+	arena_init(&ecs->event_arenas[0], 0);
+	arena_init(&ecs->event_arenas[1], 0);
 
 	_ERR(pthread_mutex_init(&ecs->global_lock, NULL) == 0);
-	_ERR(pthread_cond_init(&ecs->ready_cond, NULL) == 0);
+	_ERR(pthread_mutex_init(&ecs->job_lock, NULL) == 0);
+	_ERR(pthread_cond_init(&ecs->job_cond, NULL) == 0);
+	_ERR(pthread_cond_init(&ecs->done_cond, NULL) == 0);
 
 	ecs->is_updating = false;
 
@@ -57,21 +66,29 @@ bool ECS_SetThreads(ECS *ecs, size_t threads)
 	assert(ecs && !ecs->is_updating);
 
 	int nthreads = threads - ecs->num_threads;
-	if (nthreads <= 0) {
-		ECS_UNLOCK(ecs);
-		return true;
-	}
+	if (nthreads <= 0) return true;
+
+	// The threads look at each other's job queues, so wait until all of them
+	// are asleep before touching the thread list. New threads start off by
+	// taking the job lock, so they wait until we're done here.
+	JOB_LOCK(ecs);
+	while (ecs->sleeping_threads < ecs->num_threads)
+		pthread_cond_wait(&ecs->done_cond, &ecs->job_lock);
 
 	ThreadData **ptr = realloc(ecs->threads, sizeof(ThreadData *) * threads);
-	if (!ptr) return false;
-	for (size_t idx = ecs->num_threads; idx < threads; idx++) {
-		ptr[idx] = ECS_NewThread(ecs);
-		ERR_RET_ZERO(ptr[idx], "Error creating new thread %ld.\n", idx);
+	if (!ptr) {
+		JOB_UNLOCK(ecs);
+		return false;
 	}
-
-	ecs->num_threads = threads;
 	ecs->threads = ptr;
 
+	for (size_t idx = ecs->num_threads; idx < threads; idx++) {
+		ptr[idx] = ECS_NewThread(ecs, idx);
+		ERR(ptr[idx], JOB_UNLOCK(ecs); return false, "Error creating new thread %ld.\n", idx);
+		ecs->num_threads++;
+	}
+	JOB_UNLOCK(ecs);
+
 	// We've changed the number of threads, so we need to rearrange the queue to
 	// take advantage of that.
 	ecs->update_systems_dirty = true;
@@ -83,60 +100,101 @@ void ECS_Delete(ECS *ecs)
 {
 	assert(ecs);
 
-	// Clean up threads.
-	if (ecs->num_threads > 0 && ecs->threads) {
-		for (size_t idx = 0; idx < ecs->num_threads; idx++) {
-			pthread_cancel(ecs->threads[idx]->thread);
-			pthread_join(ecs->threads[idx]->thread, NULL);
-			ThreadData_delete(ecs->threads[idx]);
-			free(ecs->threads[idx]);
-		}
-		free(ecs->threads);
-	}
+	if (ecs->num_threads > 0 && ecs->threads) ECS_StopThreads(ecs);
 
 	// Deleting entities will delete all attached components, which make up
 	// the extreme majority of all components.
-	if (ecs->entities) {
-		Entity *entity;
-		HA_FOR(ecs->entities, entity, 0) ECS_EntityDelete(ecs, idx);
-		ha_free(ecs->entities);
+	if (ecs->entities.records) {
+		for (uint32_t idx = 0; idx < ecs->entities.size; idx++) {
+			EntityRecord *rec = &ecs->entities.records[idx];
+			if (rec->alive) ECS_EntityDelete(ecs, ENTITY_MAKE(idx, rec->generation));
+		}
+		free(ecs->entities.records);
 	}
+	free(ecs->entities.signatures);
 
 	if (ecs->systems) {
-		HT_FOR(ecs->systems) {
-			System *system = ht_get(ecs->systems, idx);
-			if (system) Manager_UnregisterSystem(ecs, system);
+		HT_ITER(ecs->systems, it) {
+			Manager_UnregisterSystem(ecs, *(System **)it.value);
 		}
 		ht_free(ecs->systems);
 	}
+	// Unregistering the systems removed all subscriptions.
+	if (ecs->subscriptions) ht_free(ecs->subscriptions);
+	Manager_FreeEvents(Manager_TakeEvents(&ecs->published));
+	arena_free(&ecs->event_arenas[0]);
+	arena_free(&ecs->event_arenas[1]);
+
+	// Clean up threads once no undispatched events live in their arenas.
+	if (ecs->num_threads > 0 && ecs->threads) {
+		for (size_t idx = 0; idx < ecs->num_threads; idx++) {
+			ThreadData_delete(ecs->threads[idx]);
+			free(ecs->threads[idx]);
+		}
+		free(ecs->threads);
+	}
 	dyn_free(&ecs->update_systems);
+	dyn_free(&ecs->schedule);
+	dyn_free(&ecs->schedule_edges);
+	dyn_free(&ecs->main_queue);
 	dyn_free(&ecs->system_order);
 
+	// All entities are gone, so the archetypes' chunks are empty.
+	if (ecs->archetypes) {
+		HT_ITER(ecs->archetypes, it) {
+			Archetype *arch = *(Archetype **)it.value;
+			Archetype_Free(arch);
+			free(arch);
+		}
+		ht_free(ecs->archetypes);
+	}
+
 	// There are only a handful of component deletions to perform at this point.
 	if (ecs->cm_types) {
-		HT_FOR(ecs->cm_types) {
-			ComponentType *type = ht_get(ecs->cm_types, idx);
-			if (type) {
-				ht_free(type->components);
-				free((char *)type->type);
-				ht_delete(ecs->cm_types, idx);
-			}
+		HT_ITER(ecs->cm_types, it) {
+			ComponentType *type = *(ComponentType **)it.value;
+			dyn_free(&type->systems);
+			if (type->components) ht_free(type->components);
+			if (type->sparse) ss_free(type->sparse);
+			free((char *)type->type);
+			ht_delete(ecs->cm_types, it.key);
+			free(type);
 		}
 		ht_free(ecs->cm_types);
 	}
+	if (ecs->type_list.ptr) dyn_free(&ecs->type_list);
 
 	// Destroy the command buffers
-	if (ecs->buffers) {
-		CommandBuffer *buff;
-		HA_FOR(ecs->buffers, buff, 0) {
-			CommandBuffer_Delete(buff);
-		}
-		ha_free(ecs->buffers);
+	if (ecs->buffers.ptr) {
+		DYN_FOR(ecs->buffers, 0) CommandBuffer_Free(*(CommandBuffer **)dyn_get(&ecs->buffers, idx));
+		dyn_free(&ecs->buffers);
 	}
 
 	free(ecs);
 }
 
+bool ECS_Reserve(ECS *ecs, size_t entities, const ECS_TypeCount *per_type_counts)
+{
+	assert(ecs);
+
+	// Systems may be using the tables that would be grown.
+	ERR_RET_ZERO(!ecs->is_updating, "Error reserving storage: the ECS is updating.\n");
+	ERR_RET_ZERO(Manager_ReserveEntities(ecs, entities), "Error reserving %zu entities.\n", entities);
+
+	for (const ECS_TypeCount *info = per_type_counts; info && info->type; info++) {
+		ComponentType *type = Manager_GetComponentType(ecs, info->type);
+		if (!type) {
+			ECS_ERROR(ecs, "Unknown component type %x.", info->type);
+			return false;
+		}
+
+		ERR_RET_ZERO(Manager_ReserveComponents(ecs, type, info->count),
+			"Error reserving %zu components of type %s.\n", info->count, type->type);
+	}
+
+	return true;
+}
+
 void ECS_Error(ECS *ecs, const char *error)
 {
 	ECS_LOCK(ecs);
@@ -148,232 +206,260 @@ void ECS_Error(ECS *ecs, const char *error)
 
 #define THREAD_MIN_LOAD 1000
 
-// wait for all threads to finish
-static void synchronize_threads(ECS *ecs)
-{
-	ECS_LOCK(ecs);
-	while (true) {
-		if (ecs->ready_threads == ecs->num_threads) {
-			ECS_UNLOCK(ecs);
-			return;
-		}
-		pthread_cond_wait(&ecs->ready_cond, &ecs->global_lock);
-	}
-}
-
-static void distribute_to_thread(ECS *ecs, ThreadData *thread, SystemQueueItem *item)
+// Two systems can run in parallel unless one writes to a component the other
+// one accesses.
+static bool systems_in_parallel(System *a, System *b)
 {
-	pthread_mutex_lock(&thread->update_mutex);
+	if (a->sig_words == 0 || b->sig_words == 0) return true;
 
-	// Pass along the data.
-	thread->system = item->system;
-	thread->range.start = item->start;
-	thread->range.end = item->end;
-	thread->ready = false;
-
-	UNREADY_THREAD(ecs);
-
-	// Let it get to work.
-	pthread_cond_signal(&thread->update_cond);
-	pthread_mutex_unlock(&thread->update_mutex);
+	return !bs_intersects(a->writes, a->sig_words, b->signature, b->sig_words)
+		&& !bs_intersects(b->writes, b->sig_words, a->reads, a->sig_words);
 }
 
-// Get the number of ready threads.
-static size_t ready_threads(ECS *ecs)
+// Returns whether system `a` lists system `b` in its AfterSystems.
+static bool system_depends_on(System *a, System *b)
 {
-	ECS_LOCK(ecs);
-	size_t ret = ecs->ready_threads;
-	ECS_UNLOCK(ecs);
-	return ret;
+	return a->dependencies && hs_get(a->dependencies, b->name_hash);
 }
 
-static void wait_until_ready(ECS *ecs, size_t num_threads)
+// Systems which aren't thread safe don't run alongside any other system.
+static bool systems_conflict(System *a, System *b)
 {
-	if (ecs->num_threads < num_threads) return;
-
-	ECS_LOCK(ecs);
-	while(ecs->ready_threads < num_threads) {
-		pthread_cond_wait(&ecs->ready_cond, &ecs->global_lock);
-	}
-	ECS_UNLOCK(ecs);
+	return !a->is_thread_safe || !b->is_thread_safe || !systems_in_parallel(a, b);
 }
 
-// Get the first ready thread index.
-static bool ready_thread(ECS *ecs, size_t *thread_idx)
+/*
+	Sort the systems so that every system comes after the systems it depends
+	on, keeping the registration order where possible.
+*/
+static void sort_systems(ECS *ecs, System **order, size_t count)
 {
-	if (!thread_idx) return false;
-
-	for (size_t idx = *thread_idx; idx < ecs->num_threads; idx++) {
-		ThreadData *data = ecs->threads[idx];
-		THREAD_LOCK(data);
-		bool ready = data->ready;
-		THREAD_UNLOCK(data);
-		if (ready) {
-			*thread_idx = idx;
-			return true;
+	System **systems = (System **)ecs->system_order.ptr;
+	uint32_t deps[count];
+	bool placed[count];
+	bool warned = false;
+
+	for (size_t idx = 0; idx < count; idx++) {
+		deps[idx] = 0;
+		placed[idx] = false;
+		for (size_t dep = 0; dep < count; dep++) {
+			if (dep != idx && system_depends_on(systems[idx], systems[dep])) deps[idx]++;
 		}
 	}
 
-	return false;
-}
+	for (size_t num = 0; num < count; num++) {
+		size_t pick = count;
+		for (size_t idx = 0; idx < count && pick == count; idx++) {
+			if (!placed[idx] && deps[idx] == 0) pick = idx;
+		}
 
-// TODO: this is O(n^2) with regards to the length of the archetypes involved
-// Fix this yesterday.
-static bool systems_in_parallel(System *a, System *b)
-{
-	// Essentially, just see if there's any overlap between the two.
-	for (size_t idxa = 0; idxa < a->archetype->size; idxa++) {
-		for (size_t idxb = 0; idxb < b->archetype->size; idxb++) {
-			if (a->archetype->components[idxa] == b->archetype->components[idxb])
-				return false;
+		// Circular dependencies; break the cycle at the earliest system.
+		if (pick == count) {
+			if (!warned) ECS_Error(ecs, "Circular system dependencies detected.");
+			warned = true;
+			for (size_t idx = 0; idx < count && pick == count; idx++) {
+				if (!placed[idx]) pick = idx;
+			}
 		}
-	}
 
-	return true;
+		placed[pick] = true;
+		order[num] = systems[pick];
+		for (size_t idx = 0; idx < count; idx++) {
+			if (!placed[idx] && system_depends_on(systems[idx], systems[pick])) deps[idx]--;
+		}
+	}
 }
 
-static bool system_requires_barrier(ECS *ecs, System *system)
+// The most jobs the update of a system is split into.
+static uint32_t max_system_jobs(ECS *ecs, System *system)
 {
-	// Walk back through the queue until we find the start, a barrier, or a
-	// system that would cause a conflict.
-	if (!system->is_thread_safe) return true;
-
-	dynarray_t *arr = &ecs->update_systems;
-	for (size_t idx = arr->size - 1; idx > 0; --idx) {
-		SystemQueueItem *item = dyn_get(arr, idx);
-		if (item->type == SYSTEM_UPDATE_BARRIER) return false;
-		if (!systems_in_parallel(system, item->system)) return true;
-	}
-
-	return false;
+	if (!system->is_thread_safe || ecs->num_threads < 2) return 1;
+	return ecs->num_threads;
 }
 
 /*
-	TODO: arrange systems in the most optimal way.
+	Split the update of a system into jobs, filling in the job slots of its
+	schedule node. This happens once the node is ready rather than when the
+	schedule is built, so that the jobs cover the entities the system has now.
 */
-void ECS_ArrangeSystems(ECS *ecs)
+void ECS_SplitSystemJobs(ECS *ecs, ScheduleNode *node)
 {
-	bool is_thread_safe = true;
-
-	#define INSERT(t) dyn_append(&ecs->update_systems, &t);
+	System *system = node->system;
+	SystemQueueItem *jobs = dyn_get(&ecs->update_systems, node->first_job);
+	SystemQueueItem item = {
+		SYSTEM_UPDATE_QUEUED,
+		ha_get(system->ent_queue, 0) ? 0 : ha_next(system->ent_queue, 0),
+		ha_last(system->ent_queue),
+		system,
+		jobs[0].node
+	};
 
-	DYN_FOR(ecs->system_order, 0) {
-		System *system = *(System **)dyn_get(&ecs->system_order, idx);
+	node->num_jobs = 0;
+	#define INSERT(t) jobs[node->num_jobs++] = t;
 
-		SystemQueueItem item = {
-			SYSTEM_UPDATE_QUEUED,
-			ha_get(system->ent_queue, 0) ? 0 : ha_next(system->ent_queue, 0),
-			ha_last(system->ent_queue),
-			system
-		};
+	// Systems that aren't thread safe are updated on the main thread.
+	if (!system->is_thread_safe) {
+		item.type = SYSTEM_UPDATE_ONTHREAD;
+		INSERT(item);
+		node->jobs_left = node->num_jobs;
+		return;
+	}
 
-		// Insert a barrier if this system conflicts
-		if (!is_thread_safe && system_requires_barrier(ecs, system)) {
-			SystemQueueItem barrier = {SYSTEM_UPDATE_BARRIER, 0, 0, NULL};
-			INSERT(barrier);
-			is_thread_safe = true;
+	// Chunked systems split their chunks across threads in stripes.
+	if (system->is_chunked) {
+		size_t num_threads = 1;
+		size_t count = Manager_SystemEntityCount(ecs, system);
+		if (node->max_jobs > 1 && count > THREAD_MIN_LOAD) {
+			num_threads = round((float)count / THREAD_MIN_LOAD);
+			if (num_threads > node->max_jobs) num_threads = node->max_jobs;
 		}
 
-		// If we're onthread, we've got a barrier up and can safely queue here.
-		if (!system->is_thread_safe) {
-			item.type = SYSTEM_UPDATE_ONTHREAD;
+		item.end = num_threads;
+		for (size_t idx = 0; idx < num_threads; idx++) {
+			item.start = idx;
 			INSERT(item);
-			continue;
 		}
+		node->jobs_left = node->num_jobs;
+		return;
+	}
 
-		// Otherwise, we've got threads running in the background.
-		is_thread_safe = false;
-
-		// If we have enough items, split them across multiple threads.
-		if (ecs->num_threads > 1 && ha_len(system->ent_queue) > THREAD_MIN_LOAD) {
-			// Ensure that we're splitting things up relatively evenly.
-			size_t num_threads = round((float)item.end / THREAD_MIN_LOAD);
-			if (num_threads > ecs->num_threads) num_threads = ecs->num_threads;
-
-			// Insert jobs for each thread.
-			size_t ents = item.end / num_threads;
-			for (size_t idx = 0; idx < num_threads; idx++) {
-				item.start = idx * ents;
-				if(!ha_get(system->ent_queue, item.start))
-					item.start = ha_next(system->ent_queue, item.start);
-				item.end = (idx + 1) * ents;
-				INSERT(item);
-			}
-		// Otherwise, just use one thread.
-		} else {
+	// If we have enough items, split them across multiple threads.
+	if (node->max_jobs > 1 && ha_len(system->ent_queue) > THREAD_MIN_LOAD) {
+		// Ensure that we're splitting things up relatively evenly.
+		size_t num_threads = round((float)item.end / THREAD_MIN_LOAD);
+		if (num_threads > node->max_jobs) num_threads = node->max_jobs;
+
+		// Insert jobs for each thread.
+		size_t last = item.end;
+		size_t ents = last / num_threads;
+		for (size_t idx = 0; idx < num_threads; idx++) {
+			item.start = idx * ents;
+			if(!ha_get(system->ent_queue, item.start))
+				item.start = ha_next(system->ent_queue, item.start);
+			item.end = idx + 1 == num_threads ? last : (idx + 1) * ents;
 			INSERT(item);
 		}
+	// Otherwise, just use one thread.
+	} else {
+		INSERT(item);
 	}
 
 	#undef INSERT
+	node->jobs_left = node->num_jobs;
 }
 
-void ECS_ResolveCommandBuffers(ECS *ecs)
+/*
+	Build the update schedule: a graph with a node for every system, and an
+	edge from each system to the later systems which depend on it or access
+	the same components. A system can start updating as soon as all of its
+	predecessors are done, without waiting for unrelated systems.
+*/
+void ECS_ArrangeSystems(ECS *ecs)
 {
-	/* TODO: refactor these for the new APIs
-	CommandBuffer *buff;
-	HA_FOR(ecs->buffers, buff, 0) {
-		hashtable_t *ht = ht_alloc(32, sizeof(hash_t));
-		for (size_t idx = 0; idx < buff->commands.size; idx++) {
-			Command *cm = dyn_get(&buff->commands, idx);
-
-			hash_t id = cm->data[0];
-			if (ht_get(ht, id)) id = *(hash_t *)ht_get(ht, id);
-			Entity *e = ECS_EntityGet(ecs, id);
-
-			if (cm->type == CMD_EntityCreate) {
-				e = ECS_EntityNew(ecs);
-				ht_insert(ht, cm->data[0], &e->id);
-			}
-			else if (cm->type == CMD_EntityDelete) {
-				if (e) ECS_EntityDelete(e);
-			}
-			else if (cm->type == CMD_ComponentAttach) {
-				ComponentInfo *c = ECS_ComponentGet(ecs, cm->data[1]);
-				if (e && c) ECS_EntityAddComponent(e, c);
-			}
-			else if (cm->type == CMD_ComponentDetach) {
-				if (e) ECS_EntityRemoveComponent(e, cm->data[1]);
-			}
-		}
+	ecs->schedule.size = 0;
+	ecs->schedule_edges.size = 0;
+	ecs->update_systems.size = 0;
+
+	const size_t count = ecs->system_order.size;
+	if (count == 0) return;
+
+	System *order[count];
+	sort_systems(ecs, order, count);
+
+	// Reserve job slots for each system; they're filled in by
+	// ECS_SplitSystemJobs as the system comes up in the schedule.
+	for (uint32_t idx = 0; idx < count; idx++) {
+		ScheduleNode node = {order[idx], ecs->update_systems.size};
+		node.max_jobs = max_system_jobs(ecs, order[idx]);
+
+		SystemQueueItem item = { SYSTEM_UPDATE_QUEUED, 0, 0, order[idx], idx };
+		for (uint32_t job = 0; job < node.max_jobs; job++)
+			dyn_append(&ecs->update_systems, &item);
+		dyn_append(&ecs->schedule, &node);
+	}
 
-		ht_free(ht);
-		CommandBuffer_Delete(buff);
+	// Systems only ever wait on systems earlier in the order.
+	for (uint32_t idx = 0; idx < count; idx++) {
+		ScheduleNode *node = dyn_get(&ecs->schedule, idx);
+		node->first_edge = ecs->schedule_edges.size;
+
+		for (uint32_t next = idx + 1; next < count; next++) {
+			if (!system_depends_on(order[next], order[idx])
+				&& !systems_conflict(order[idx], order[next]))
+				continue;
+
+			dyn_append(&ecs->schedule_edges, &next);
+			node->num_edges++;
+			((ScheduleNode *)dyn_get(&ecs->schedule, next))->num_deps++;
+		}
 	}
-	*/
 }
 
-// Distribute an update to a thread.
-void ECS_DispatchSystemUpdate(ECS *ecs, SystemQueueItem *item)
+typedef struct {
+	ECS *ecs;
+	System *system;
+} EventDispatch;
+
+static void dispatch_events(Event *events, size_t count, void *udata)
 {
-	if (item->type == SYSTEM_UPDATE_QUEUED && ecs->num_threads > 0) {
-		wait_until_ready(ecs, 1);
-		size_t thread_idx = 0;
-		// At least one thread is ready. Assert if this is false.
-		assert(ready_thread(ecs, &thread_idx));
-		distribute_to_thread(ecs, ecs->threads[thread_idx], item);
-	}
-	else {
-		Entity *entity;
-		if (item->start == item->end && item->end == 0) {
-			Manager_UpdateSystem(ecs, item->system, 0);
-			return;
-		}
+	EventDispatch *dispatch = udata;
+	for (size_t idx = 0; idx < count; idx++)
+		Manager_SystemEvent(dispatch->ecs, dispatch->system, &events[idx]);
+}
 
-		HA_RANGE_FOR(item->system->ent_queue, entity, item->start, item->end) {
-			Manager_UpdateSystem(ecs, item->system, *entity);
-		}
-	}
+static void dispatch_system_events(ECS *ecs, size_t task, void *udata)
+{
+	EventDispatch dispatch = { ecs, ((System **)udata)[task] };
+	EventQueue_Drain(dispatch.system->ev_queue, dispatch_events, &dispatch);
 }
 
-// Resolve a barrier
-void ECS_DispatchBarrier(ECS *ecs, SystemQueueItem *item)
+/*
+	Dispatch the events of every system. The systems with events are split
+	into waves in schedule order, each wave holding systems which could also
+	update at the same time, and each wave is dispatched on the threads.
+*/
+static void dispatch_all_events(ECS *ecs)
 {
-	synchronize_threads(ecs);
+	// Events sent from here on are only dispatched in the next update.
+	EventNode *published = Manager_TakeEvents(&ecs->published);
+	uint32_t frame = ecs->event_frame;
+	ecs->event_frame ^= 1;
+	size_t count = 0;
+	System *pending[ecs->schedule.size + 1];
+
+	DYN_FOR(ecs->schedule, 0) {
+		System *system = ((ScheduleNode *)dyn_get(&ecs->schedule, idx))->system;
+		Manager_CollectEvents(system);
+
+		if (!system->ev_func) EventQueue_Clear(system->ev_queue);
+		else if (EventQueue_Size(system->ev_queue) > 0) pending[count++] = system;
+	}
+
+	while (count > 0) {
+		System *wave[count];
+		size_t wave_size = 0, left = 0;
 
-	if (ha_len(ecs->buffers) > 0) {
-		ECS_ResolveCommandBuffers(ecs);
+		for (size_t idx = 0; idx < count; idx++) {
+			bool conflict = false;
+			for (size_t other = 0; other < wave_size && !conflict; other++)
+				conflict = systems_conflict(pending[idx], wave[other]);
+
+			if (conflict)
+				pending[left++] = pending[idx];
+			else
+				wave[wave_size++] = pending[idx];
+		}
+
+		// Waves of a single system are dispatched right here.
+		ECS_RunTasks(ecs, wave_size, dispatch_system_events, wave);
+		count = left;
 	}
+
+	Manager_FreeEvents(published);
+
+	arena_reset(&ecs->event_arenas[frame]);
+	for (size_t idx = 0; idx < ecs->num_threads; idx++)
+		arena_reset(&ecs->threads[idx]->event_arenas[frame]);
 }
 
 /*
@@ -399,39 +485,22 @@ void ECS_DispatchBarrier(ECS *ecs, SystemQueueItem *item)
 */
 void ECS_Update(ECS *ecs)
 {
+	assert(ecs && !ecs->is_updating);
+	ecs->is_updating = true;
+
 	// If it needs it, update the queue.
 	if (ecs->update_systems_dirty) {
 		ECS_ArrangeSystems(ecs);
 		ecs->update_systems_dirty = false;
 	}
 
-	// Dispatch all updates and resolve barriers.
-	for (size_t idx = 0; idx < ecs->update_systems.size; idx++) {
-		SystemQueueItem *item = dyn_get(&ecs->update_systems, idx);
-
-		switch (item->type) {
-		case SYSTEM_UPDATE_BARRIER:
-			ECS_DispatchBarrier(ecs, item);
-			break;
-		case SYSTEM_UPDATE_ONTHREAD:
-			synchronize_threads(ecs);
-		case SYSTEM_UPDATE_QUEUED:
-			ECS_DispatchSystemUpdate(ecs, item);
-			break;
-		default:
-			break;
-		}
-	}
+	// Update every system, as soon as the systems it depends on are done.
+	ECS_RunSchedule(ecs);
 
 	// Dispatch events.
-	HT_FOR(ecs->systems) {
-		System *system = ht_get(ecs->systems, idx);
-		DYN_FOR(*system->ev_queue, 0) {
-			Event *ev = EventQueue_Peek(system->ev_queue, idx);
-			Manager_SystemEvent(ecs, system, ev);
-		}
-		EventQueue_Clear(system->ev_queue);
-	}
+	dispatch_all_events(ecs);
+
+	ECS_ResolveCommandBuffers(ecs);
 
-	synchronize_threads(ecs);
+	ecs->is_updating = false;
 }
@@ -6,18 +6,24 @@ Entity ECS_EntityNew(ECS *ecs, EntityArchetype *archetype)
 	assert(ecs);
 
 	Entity entity = Manager_CreateEntity(ecs);
+	if (!entity) return 0;
+
 	if (archetype) {
+		// Place the entity in its final chunk archetype straight away, rather
+		// than moving it once per chunked component.
+		ComponentType *types[archetype->size];
+		uint32_t num_types = 0;
+
 		for (uint32_t idx = 0; idx < archetype->size; idx++) {
 			hash_t id = archetype->components[idx];
 
-			ComponentType *cm_type = ht_get(ecs->cm_types, id);
+			ComponentType *cm_type = Manager_GetComponentType(ecs, id);
 			ERR_CONTINUE(cm_type, "Error creating component: unregistered type %08x", id);
-
-			Component *comp = Manager_CreateComponent(ecs, cm_type, entity);
-			ERR_NO_RET(comp, "Error creating component of type %s.\n", cm_type->type);
+			types[num_types++] = cm_type;
 		}
 
-		Manager_UpdateCollections(ecs, entity);
+		if (!Manager_ApplyComponents(ecs, entity, types, NULL, num_types, NULL, 0))
+			ECS_ERROR(ecs, "Error creating components for entity %08x.", entity);
 	}
 
 	return entity;
@@ -34,7 +40,7 @@ bool ECS_EntityExists(ECS *ecs, Entity entity)
 {
 	assert(ecs);
 
-	return ha_get(ecs->entities, entity);
+	return Manager_GetEntity(ecs, entity) != NULL;
 }
 
 const char* ECS_EntityToString(Entity entity)
@@ -45,20 +51,27 @@ const char* ECS_EntityToString(Entity entity)
 	return str;
 }
 
-#define GET_TYPE(ecs, type, ret) ComponentType *cm_type = ht_get(ecs->cm_types, type); \
+#define GET_TYPE(ecs, type, ret) ComponentType *cm_type = Manager_GetComponentType(ecs, type); \
 	if (!cm_type) { \
 		ECS_ERROR(ecs, "Unknown component type %x.", type); \
 		return ret; \
 	}
 
+// Catch stale entity handles before they reach component storage.
+#define CHECK_ENTITY(ecs, entity, ret) if (!Manager_GetEntity(ecs, entity)) { \
+		ECS_ERROR(ecs, "Invalid or deleted entity %08x.", entity); \
+		return ret; \
+	}
+
 Component* ECS_EntityAddComponent(ECS *ecs, Entity entity, hash_t type)
 {
 	assert(ecs);
 
 	GET_TYPE(ecs, type, NULL);
+	CHECK_ENTITY(ecs, entity, NULL);
 
 	// If we already have a component on the entity, return it.
-	Component *comp = ht_get(cm_type->components, entity);
+	Component *comp = Manager_GetComponent(ecs, cm_type, entity);
 	if (comp) return comp;
 
 	// Otherwise, create the new component.
@@ -68,7 +81,7 @@ Component* ECS_EntityAddComponent(ECS *ecs, Entity entity, hash_t type)
 	// We do this at the AddComponent / RemoveComponent step to gain performance.
 	// Adding components to entities takes about 0.5x more time, but it gains an
 	// immense amount of performance on the update step.
-	Manager_UpdateCollections(ecs, entity);
+	if (comp) Manager_UpdateCollections(ecs, entity, cm_type);
 
 	return comp;
 }
@@ -78,7 +91,9 @@ Component* ECS_EntityGetComponent(ECS *ecs, Entity entity, hash_t type)
 	assert(ecs);
 
 	GET_TYPE(ecs, type, NULL);
-	return ht_get(cm_type->components, entity);
+	if (!Manager_GetEntity(ecs, entity)) return NULL;
+
+	return Manager_GetComponent(ecs, cm_type, entity);
 }
 
 void ECS_EntityRemoveComponent(ECS *ecs, Entity entity, hash_t type)
@@ -86,11 +101,12 @@ void ECS_EntityRemoveComponent(ECS *ecs, Entity entity, hash_t type)
 	assert(ecs);
 
 	GET_TYPE(ecs, type,);
+	CHECK_ENTITY(ecs, entity,);
 
-	if (!ht_get(cm_type->components, entity)) return;
+	if (!Manager_GetComponent(ecs, cm_type, entity)) return;
 
 	Manager_DeleteComponent(ecs, cm_type, entity);
-	Manager_UpdateCollections(ecs, entity);
+	Manager_UpdateCollections(ecs, entity, cm_type);
 }
 
 EntityArchetype* ECS_EntityRegisterArchetype(ECS *ecs, const char *name, const char **components)
@@ -106,12 +122,13 @@ EntityArchetype* ECS_EntityRegisterArchetype(ECS *ecs, const char *name, const c
 
 	arch->name_hash = hash_string(name);
 
-	arch->size = string_arr_to_type(&arch->components, components);
-	ERR_OOM(arch->components, "creating EntityArchetype");
+	int size = string_arr_to_type(&arch->components, &arch->read_only, components);
+	ERR_RET_NULL(size >= 0, "ERROR creating EntityArchetype: Out of Memory.\n");
+	arch->size = size;
 
 	for (size_t idx = 0; idx < arch->size; idx++) {
 		hash_t id = arch->components[idx];
-		ComponentType *cm_type = ht_get(ecs->cm_types, id);
+		ComponentType *cm_type = Manager_GetComponentType(ecs, id);
 		ERR_RET_NULL(cm_type, "Error creating EntityArchetype: unknown component type %08x", id);
 	}
 
@@ -2,67 +2,129 @@
 
 #include <assert.h>
 
+#define EVENT_QUEUE_SIZE 16
+
+#define QUEUE_SLOT(queue, pos) (&(queue)->events[(pos) & ((queue)->capacity - 1)])
+
+void Event_Copy(Event *dst, const Event *src)
+{
+    *dst = *src;
+    if (dst->is_inline) dst->data = dst->payload;
+}
+
 EventQueue* EventQueue_New()
 {
     EventQueue *queue = malloc(sizeof(EventQueue));
     if (!queue) return NULL;
 
-    if (!dyn_alloc(queue, 16, sizeof(Event))) return NULL;
+    queue->events = malloc(sizeof(Event) * EVENT_QUEUE_SIZE);
+    queue->capacity = EVENT_QUEUE_SIZE;
+    queue->head = queue->tail = 0;
+
+    if (!queue->events) {
+        free(queue);
+        return NULL;
+    }
 
     return queue;
 }
 
 void EventQueue_Free(EventQueue *queue)
 {
-    assert(queue && queue->ptr);
+    assert(queue && queue->events);
 
-    dyn_free(queue);
+    EventQueue_Clear(queue);
+    free(queue->events);
     free(queue);
 }
 
+size_t EventQueue_Size(EventQueue *queue)
+{
+    assert(queue);
+
+    return queue->tail - queue->head;
+}
+
 Event* EventQueue_Peek(EventQueue *queue, int idx)
 {
-    assert(queue && queue->ptr);
+    assert(queue && queue->events);
 
-    return dyn_get(queue, idx);
+    if (idx < 0 || (size_t)idx >= queue->tail - queue->head) return NULL;
+    return QUEUE_SLOT(queue, queue->head + idx);
 }
 
 bool EventQueue_Pop(EventQueue *queue, Event *ev)
 {
-    assert(queue && queue->ptr);
+    assert(queue && queue->events);
 
-    Event *event = dyn_get(queue, 0);
-    if (!ev) return false;
+    if (queue->head == queue->tail) return false;
+    Event *event = QUEUE_SLOT(queue, queue->head++);
 
     // If we're copying the event somewhere, we don't want to free the data.
     if (ev) {
-        *ev = *event;
+        Event_Copy(ev, event);
     }
     // If we're not, the event is being deleted, and the data should follow.
-    else if (ev->should_free) {
+    else if (event->should_free) {
         free(event->data);
     }
 
-    dyn_remove(queue, 0, false);
+    // Start over at the beginning of the buffer whenever we run dry.
+    if (queue->head == queue->tail) queue->head = queue->tail = 0;
+    return true;
+}
+
+// Double the capacity of a full queue, unwrapping the ring into the new buffer.
+static bool grow(EventQueue *queue)
+{
+    size_t capacity = queue->capacity * 2;
+    Event *events = malloc(sizeof(Event) * capacity);
+    if (!events) return false;
+
+    for (size_t pos = queue->head; pos != queue->tail; pos++)
+        Event_Copy(&events[pos - queue->head], QUEUE_SLOT(queue, pos));
+
+    free(queue->events);
+    queue->events = events;
+    queue->tail -= queue->head;
+    queue->head = 0;
+    queue->capacity = capacity;
     return true;
 }
 
 void EventQueue_Push(EventQueue *queue, Event *event)
 {
-    assert(queue && queue->ptr && event);
+    assert(queue && queue->events && event);
+
+    if (queue->tail - queue->head == queue->capacity && !grow(queue)) return;
+
+    Event_Copy(QUEUE_SLOT(queue, queue->tail++), event);
+}
+
+size_t EventQueue_Drain(EventQueue *queue, event_drain_func func, void *udata)
+{
+    assert(queue && queue->events && func);
+
+    // The events are contiguous, except where the ring wraps around.
+    size_t count = queue->tail - queue->head;
+    size_t first = queue->head & (queue->capacity - 1);
+    size_t run = count < queue->capacity - first ? count : queue->capacity - first;
+
+    if (run > 0) func(queue->events + first, run, udata);
+    if (count > run) func(queue->events, count - run, udata);
 
-    dyn_append(queue, event);
+    EventQueue_Clear(queue);
+    return count;
 }
 
 void EventQueue_Clear(EventQueue *queue)
 {
-    assert(queue && queue->ptr);
+    assert(queue && queue->events);
 
-    DYN_FOR(*queue, 0) {
-        Event *ev = dyn_get(queue, idx);
+    for (size_t pos = queue->head; pos != queue->tail; pos++) {
+        Event *ev = QUEUE_SLOT(queue, pos);
         if (ev->should_free) free(ev->data);
-        dyn_delete(queue, idx);
     }
 
-    queue->size = 0;
+    queue->head = queue->tail = 0;
 }
@@ -4,9 +4,17 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "bitset.h"
 #include "hasharray.h"
 #include "mempool.h"
 
+/*
+    Which slots are filled is tracked in a bitmap with one bit per slot, plus
+    two summary bitmaps with one bit per word of it: one marking the words
+    with a filled slot, and one marking the words with a free slot. Finding
+    the next filled or free slot checks the current word, then skips straight
+    to the next candidate word through the summary.
+*/
 struct hasharray_t {
     size_t count;
     size_t capacity;
@@ -15,22 +23,101 @@ struct hasharray_t {
     hash_t last_filled;
     mempool_t *storage;
     void **entries;
+
+    // The number of words in the filled bitmap.
+    size_t words;
+    bitset_t *filled;
+    bitset_t *filled_words;
+    bitset_t *free_words;
 };
 
+#define FULL_WORD (~(bitset_t)0)
+
+static void update_summary(hasharray_t *ha, size_t word)
+{
+    if (ha->filled[word]) bs_set(ha->filled_words, word);
+    else bs_clear(ha->filled_words, word);
+
+    if (ha->filled[word] != FULL_WORD) bs_set(ha->free_words, word);
+    else bs_clear(ha->free_words, word);
+}
+
+/*
+    Returns the first slot at or after `bit` whose bit in the filled bitmap
+    differs from `flip`, or words * BITSET_WORD_BITS if there is none. Slots
+    past the end of the array count as free.
+*/
+static size_t find_slot(hasharray_t *ha, const bitset_t *summary, bitset_t flip, size_t bit)
+{
+    size_t end = ha->words * BITSET_WORD_BITS;
+    size_t word = bit / BITSET_WORD_BITS;
+    if (word >= ha->words) return end;
+
+    bitset_t bits = (ha->filled[word] ^ flip) & (FULL_WORD << (bit % BITSET_WORD_BITS));
+    if (bits) return word * BITSET_WORD_BITS + __builtin_ctzll(bits);
+
+    word = bs_next(summary, BITSET_WORDS(ha->words), word + 1);
+    if (word >= ha->words) return end;
+    return word * BITSET_WORD_BITS + __builtin_ctzll(ha->filled[word] ^ flip);
+}
+
+// Returns the index after the last filled slot at or before `word`.
+static size_t find_last(hasharray_t *ha, size_t word)
+{
+    // Find the last word with a filled slot through the summary.
+    size_t summary = word / BITSET_WORD_BITS;
+    bitset_t bits = ha->filled_words[summary]
+        & (FULL_WORD >> (BITSET_WORD_BITS - 1 - word % BITSET_WORD_BITS));
+    while (!bits) {
+        if (summary-- == 0) return 0;
+        bits = ha->filled_words[summary];
+    }
+
+    word = summary * BITSET_WORD_BITS + BITSET_WORD_BITS - 1 - __builtin_clzll(bits);
+    return word * BITSET_WORD_BITS + BITSET_WORD_BITS - __builtin_clzll(ha->filled[word]);
+}
+
+// Grow the array and its bitmaps to hold `capacity` slots.
+static bool grow(hasharray_t *ha, size_t capacity)
+{
+    size_t words = BITSET_WORDS(capacity);
+    size_t summary_words = BITSET_WORDS(words);
+    size_t old_summary_words = BITSET_WORDS(ha->words);
+
+    // Buffers that did grow are kept, but the array only takes on the new
+    // capacity once all of them have.
+    void **entries = realloc(ha->entries, sizeof(void *) * capacity);
+    if (entries) ha->entries = entries;
+    bitset_t *filled = realloc(ha->filled, sizeof(bitset_t) * words);
+    if (filled) ha->filled = filled;
+    bitset_t *filled_words = realloc(ha->filled_words, sizeof(bitset_t) * summary_words);
+    if (filled_words) ha->filled_words = filled_words;
+    bitset_t *free_words = realloc(ha->free_words, sizeof(bitset_t) * summary_words);
+    if (free_words) ha->free_words = free_words;
+    if (!entries || !filled || !filled_words || !free_words) return false;
+
+    memset(&entries[ha->capacity], 0, sizeof(void *) * (capacity - ha->capacity));
+    memset(&filled[ha->words], 0, sizeof(bitset_t) * (words - ha->words));
+    memset(&filled_words[old_summary_words], 0,
+        sizeof(bitset_t) * (summary_words - old_summary_words));
+    memset(&free_words[old_summary_words], 0,
+        sizeof(bitset_t) * (summary_words - old_summary_words));
+
+    for (size_t word = ha->words; word < words; word++) bs_set(free_words, word);
+    ha->capacity = capacity;
+    ha->words = words;
+    return true;
+}
+
 hasharray_t* ha_alloc(size_t min_size, size_t entry_size)
 {
-    hasharray_t *ha = malloc(sizeof(hasharray_t));
+    hasharray_t *ha = calloc(1, sizeof(hasharray_t));
     if (!ha) return NULL;
 
-    ha->count = 0;
-    ha->capacity = min_size;
     ha->entry_size = entry_size;
-    ha->first_free = 0;
-    ha->last_filled = 0;
     ha->storage = mp_init(min_size, entry_size);
-    ha->entries = calloc(min_size, sizeof(void *));
 
-    if (!ha->entries || !ha->storage) {
+    if (!ha->storage || !grow(ha, min_size ? min_size : 1)) {
         ha_free(ha);
         return NULL;
     }
@@ -43,23 +130,22 @@ void ha_free(hasharray_t *ha)
     assert(ha);
 
     free(ha->entries);
-    mp_destroy(ha->storage);
+    free(ha->filled);
+    free(ha->filled_words);
+    free(ha->free_words);
+    if (ha->storage) mp_destroy(ha->storage);
     free(ha);
 }
 
 void* ha_insert(hasharray_t *ha, hash_t idx, void *data) {
     assert(ha && ha->entries && ha->storage);
 
-    // Resize the array to at least fit the new index.
+    // Resize the array to at least fit the new index, doubling its capacity
+    // so that sequential inserts don't resize every time.
     if (idx >= ha->capacity) {
-        size_t newsize = sizeof(void *) * (idx + 1);
-        size_t size_diff = newsize - (ha->capacity * sizeof(void *));
-        void **ptr = realloc(ha->entries, newsize);
-        if (!ptr) return NULL;
-
-        memset(&ptr[ha->capacity], 0, size_diff);
-        ha->capacity = idx + 1;
-        ha->entries = ptr;
+        size_t capacity = ha->capacity * 2;
+        if (capacity <= idx) capacity = idx + 1;
+        if (!grow(ha, capacity)) return NULL;
     }
 
     // Get space for the entry
@@ -68,10 +154,13 @@ void* ha_insert(hasharray_t *ha, hash_t idx, void *data) {
         entry = mp_alloc(ha->storage);
         if (!entry) return NULL;
         ha->entries[idx] = entry;
+        ha->count++;
+
+        bs_set(ha->filled, idx);
+        update_summary(ha, idx / BITSET_WORD_BITS);
     }
 
-    ha->count++;
-    if (idx > ha->last_filled) {
+    if (idx >= ha->last_filled) {
         ha->last_filled = idx + 1;
     }
     if (idx == ha->first_free) {
@@ -86,6 +175,13 @@ void* ha_insert(hasharray_t *ha, hash_t idx, void *data) {
     return entry;
 }
 
+bool ha_reserve(hasharray_t *ha, size_t capacity)
+{
+    assert(ha && ha->entries);
+
+    return capacity <= ha->capacity || grow(ha, capacity);
+}
+
 void* ha_insert_free(hasharray_t *ha, hash_t *idx, void *data)
 {
     assert(ha && ha->entries && ha->storage);
@@ -111,10 +207,11 @@ hash_t ha_next(hasharray_t *ha, hash_t idx)
 {
     assert(ha && ha->entries);
 
-    // Cycle through until we find the next full entry or the last filled entry
-    // in the array.
-    while(++idx < ha->last_filled && !ha->entries[idx]) continue;
-    return idx;
+    // Find the next full entry, or stop at the last filled entry in the array.
+    if (++idx >= ha->last_filled) return idx;
+
+    size_t next = find_slot(ha, ha->filled_words, 0, idx);
+    return next < ha->last_filled ? next : ha->last_filled;
 }
 
 hash_t ha_first_free(hasharray_t *ha)
@@ -123,7 +220,7 @@ hash_t ha_first_free(hasharray_t *ha)
 
     hash_t idx = ha->first_free;
     if (idx >= ha->capacity) return ha->first_free;
-    else if ( ha->entries[idx]) {
+    else if (ha->entries[idx]) {
         idx = ha->first_free = ha_next_free(ha, idx);
     }
 
@@ -134,10 +231,11 @@ hash_t ha_next_free(hasharray_t *ha, hash_t idx)
 {
     assert(ha && ha->entries);
 
-    // Cycle through until we find the next free entry or the end of the array.
-    // TODO: make this less O(N)? Maybe a balanced search of some sort?
-    while(ha->capacity > ++idx && ha->entries[idx]) continue;
-    return idx;
+    // Find the next free entry or the end of the array.
+    if (++idx >= ha->capacity) return idx;
+
+    size_t next = find_slot(ha, ha->free_words, FULL_WORD, idx);
+    return next < ha->capacity ? next : ha->capacity;
 }
 
 hash_t ha_last(hasharray_t *ha)
@@ -149,12 +247,16 @@ void ha_delete(hasharray_t *ha, hash_t idx)
 {
     assert(ha && ha->entries && ha->storage);
 
-    if (!ha->entries[idx]) return;
+    if (idx >= ha->capacity || !ha->entries[idx]) return;
 
     mp_free(ha->storage, ha->entries[idx]);
     ha->entries[idx] = NULL;
     ha->count--;
 
+    size_t word = idx / BITSET_WORD_BITS;
+    bs_clear(ha->filled, idx);
+    update_summary(ha, word);
+
     if (idx < ha->first_free) ha->first_free = idx;
-    if (idx == ha->last_filled) ha->last_filled--;
+    if (idx + 1 == ha->last_filled) ha->last_filled = find_last(ha, word);
 }
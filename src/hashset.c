@@ -29,11 +29,12 @@ hashset_t* hs_alloc(size_t initial_size)
     hs->buckets = calloc(initial_size, sizeof(bucket_t *));
     hs->storage = mp_init(initial_size, sizeof(bucket_t));
     hs->size = initial_size;
+    hs->count = 0;
 
     return hs;
 }
 
-void hs_delete(hashset_t *hs)
+void hs_free(hashset_t *hs)
 {
     mp_destroy(hs->storage);
     free(hs->buckets);
@@ -44,49 +45,39 @@ void hs_resize(hashset_t *hs)
 {
     size_t oldsize = hs->size;
     size_t newsize = hs->size * 2;
-    void *ptr = realloc(hs->buckets, sizeof(bucket_t *) * newsize);
-    ERR_RET(ptr, "Error allocating memory for hashset.\n");
+    bucket_t **buckets = calloc(newsize, sizeof(bucket_t *));
+    ERR_RET(buckets, "Error allocating memory for hashset.\n");
 
+    bucket_t **old = hs->buckets;
     hs->size = newsize;
-    hs->buckets = ptr;
+    hs->buckets = buckets;
 
+    // Move every bucket to the front of its list at the new position.
     for (size_t idx = 0; idx < oldsize; idx++) {
-        bucket_t *bk = hs->buckets[idx];
-        bucket_t **last = &hs->buckets[idx];
-
-        if (!bk) continue;
-
-        while(bk) {
-            size_t n_idx = GET_IDX(hs, bk->hash);
-            if (n_idx == idx) continue;
-
-            // Shuffle around all of our pointers to insert the bucket in the
-            // list at the new position.
+        bucket_t *bk = old[idx];
+        while (bk) {
             bucket_t *next = bk->next;
-            bucket_t *bk2 = hs->buckets[n_idx];
-            hs->buckets[n_idx] = bk;
-            bk->next = bk2;
-
+            bucket_t **head = &GET_BUCKET(hs, bk->hash);
+            bk->next = *head;
+            *head = bk;
             bk = next;
-            (*last)->next = bk;
         }
     }
+
+    free(old);
 }
 
 void hs_set(hashset_t *hs, hash_t hash)
 {
-    bucket_t *bk = GET_BUCKET(hs, hash);
-    while (bk) {
-        if (bk->hash == hash) return;
-        if (!bk->next) break;
-        bk = bk->next;
-    }
+    if (hs_get(hs, hash)) return;
 
     if (hs->count > (float)hs->size * 0.7) hs_resize(hs);
 
     bucket_t *next = mp_alloc(hs->storage);
+    ERR_RET(next, "Error allocating memory for hashset.\n");
     next->hash = hash;
-    bk->next = next;
+    next->next = GET_BUCKET(hs, hash);
+    GET_BUCKET(hs, hash) = next;
     hs->count++;
 }
 
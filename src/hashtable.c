@@ -1,189 +1,415 @@
 #include "hashtable.h"
-#include "zlib.h"
-#include "mempool.h"
 #include "manager.h"
 
-#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /*
-	Buckets are stored as chunks in a memory pool. Each chunk has the format:
-
-	struct chunk {
-		void **prev;
-		hash_t hash;
-		char[sizeof(data)] val;
-	}
+	An open-addressing hash table, in the style of a Swiss table.
+
+	The index is an array of control bytes plus a parallel array of slots,
+	both split into groups of GROUP_SIZE. A control byte is either CTRL_EMPTY,
+	CTRL_DELETED, or 7 bits of the key's mixed hash, and a whole group of them
+	is compared against a key at once (with SSE2 where available). A lookup
+	usually touches a single group of control bytes and a single slot.
+
+	Slots hold the key and its value side by side, so finding a key and
+	reading its value is one more cache line after the control bytes. Keys are
+	often sequential entity IDs, so a key's home group is taken straight from
+	its low bits: each run of GROUP_KEYS consecutive keys shares a group, and
+	walking the keys in order walks the slots in order too. Each key also has
+	a preferred slot in its home group, which is tried before matching the
+	whole group, so such keys are usually found with a single compare. Only
+	half of each group is filled that way, so a lookup for a missing key near
+	them still stops at its home group.
+
+	Values move when the index grows, so pointers to them only stay valid
+	until the next insert or delete. The ECS keeps pointers to its systems,
+	component types and archetypes in their tables instead.
+
+	The table also keeps an array of its keys in insertion order, and each
+	slot remembers its position in it. Deleting a key leaves a stale position
+	behind, which is closed up the next time the array would have to grow, so
+	iterating over the table reads the array front to back instead of probing
+	the whole index.
+
+	Growing the index does not rehash every key at once. The new index is
+	allocated next to the old one, and each following insert or delete moves
+	MIGRATE_SLOTS slots across, so the cost of growth is spread over many
+	operations. Until then, lookups check both indexes.
 */
 
-#define LOAD_MAX 0.8f
+#define GROUP_SIZE 16
+#define GROUP_KEYS (GROUP_SIZE / 2)
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xFE
+
+// The index is rebuilt once it is 7/8 full, counting deleted slots.
+#define LOAD_NUM 7
+#define LOAD_DEN 8
+
+// The number of slots moved from the old index per insert or delete.
+#define MIGRATE_SLOTS 64
 
-// Walk backwards until condition c is met.
-#define WALK_BACKWARDS(ht, idx, c) \
-	bucket_t *ent = (ht)->buckets[(idx)]; \
-	while (!(c)) ent = ent->prev
+#define NO_SLOT SIZE_MAX
 
-typedef struct bucket_t bucket_t;
-struct bucket_t {
-	bucket_t *prev;
+// Lookups are on the hot path of every component access; keep the helpers
+// inlined even in debug builds.
+#define HOT static inline __attribute__((always_inline))
+
+typedef struct {
 	hash_t hash;
+	// The position of the key in the insertion order array.
+	uint32_t order;
 	// this stores the hashtable's data. It is aligned to the 8-byte boundary
 	char data[] __attribute__((aligned(8)));
-};
+} slot_t;
+
+typedef struct {
+	// The number of slots, a power of two.
+	size_t capacity;
+	size_t slot_size;
+	uint8_t *ctrl;
+	char *slots;
+} index_t;
 
 struct hashtable_t {
-	size_t size;
 	size_t data_size;
 	size_t count;
 
-	// Some bookkeeping to speed up calls to ht_next and ht_next_free.
+	index_t index;
+	size_t deleted;
+
+	// The index being migrated away from, if any, and the next slot to move.
+	index_t old;
+	size_t migrated;
+
+	// Keys in insertion order. A position is only current if the key's slot
+	// still points back at it.
+	hash_t *order;
+	size_t order_size;
+	size_t order_capacity;
+
+	// Some bookkeeping to speed up calls to ht_get_free.
 	hash_t first_free;
-	mempool_t *storage;
-	bucket_t **buckets;
 };
 
-static inline size_t get_bucket_idx(hashtable_t *ht, hash_t hash)
+// Spread the bits of the key over the whole word, for the control bytes.
+HOT uint64_t mix(hash_t hash)
+{
+	return (uint64_t)hash * 0x9E3779B97F4A7C15ull;
+}
+
+HOT uint8_t ctrl_hash(hash_t hash)
+{
+	return mix(hash) >> 57;
+}
+
+HOT size_t home_group(hash_t hash, size_t group_mask)
+{
+	return (size_t)(hash / GROUP_KEYS) & group_mask;
+}
+
+// The slot a key takes if it is free, in the key's home group.
+HOT size_t preferred_slot(hash_t hash, size_t group_mask)
+{
+	return home_group(hash, group_mask) * GROUP_SIZE + hash % GROUP_KEYS;
+}
+
+HOT slot_t* get_slot(const index_t *index, size_t idx)
+{
+	return (slot_t *)(index->slots + idx * index->slot_size);
+}
+
+// Returns a bitmask of the control bytes in a group equal to `byte`.
+HOT uint32_t match_byte(const uint8_t *ctrl, uint8_t byte)
+{
+#ifdef __SSE2__
+	__m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+#else
+	uint32_t mask = 0;
+	for (int idx = 0; idx < GROUP_SIZE; idx++) mask |= (uint32_t)(ctrl[idx] == byte) << idx;
+	return mask;
+#endif
+}
+
+// Returns a bitmask of the empty or deleted slots in a group, which are the
+// control bytes with their high bit set.
+HOT uint32_t match_free(const uint8_t *ctrl)
+{
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+	uint32_t mask = 0;
+	for (int idx = 0; idx < GROUP_SIZE; idx++) mask |= (uint32_t)(ctrl[idx] >> 7) << idx;
+	return mask;
+#endif
+}
+
+// Find the slot holding a key. Groups are probed quadratically, which visits
+// every group of a power of two sized index.
+HOT size_t find_slot(const index_t *index, hash_t hash)
 {
-	return hash % ht->size;
+	size_t group_mask = index->capacity / GROUP_SIZE - 1;
+	size_t idx = preferred_slot(hash, group_mask);
+	if (!(index->ctrl[idx] & 0x80) && get_slot(index, idx)->hash == hash) return idx;
+
+	size_t group = home_group(hash, group_mask);
+	uint8_t tag = ctrl_hash(hash);
+
+	for (size_t step = 1; step <= group_mask + 1; step++) {
+		const uint8_t *ctrl = index->ctrl + group * GROUP_SIZE;
+		for (uint32_t match = match_byte(ctrl, tag); match; match &= match - 1) {
+			idx = group * GROUP_SIZE + __builtin_ctz(match);
+			if (get_slot(index, idx)->hash == hash) return idx;
+		}
+
+		// The key would have been placed in this group's empty slot.
+		if (match_byte(ctrl, CTRL_EMPTY)) return NO_SLOT;
+		group = (group + step) & group_mask;
+	}
+
+	return NO_SLOT;
 }
 
-// Get an entry in a hashtable bucket.
-static inline bucket_t* get_entry(hashtable_t *ht, hash_t hash)
+// Find the first empty or deleted slot along a key's probe sequence.
+static size_t find_free_slot(const index_t *index, hash_t hash)
 {
-	const size_t idx = get_bucket_idx(ht, hash);
-	bucket_t *bucket_ptr = ht->buckets[idx];
-	while (bucket_ptr != NULL) {
-		if (bucket_ptr->hash == hash) return bucket_ptr;
-		bucket_ptr = bucket_ptr->prev;
+	size_t group_mask = index->capacity / GROUP_SIZE - 1;
+	size_t idx = preferred_slot(hash, group_mask);
+	if (index->ctrl[idx] & 0x80) return idx;
+
+	size_t group = home_group(hash, group_mask);
+	for (size_t step = 1; ; step++) {
+		uint32_t free = match_free(index->ctrl + group * GROUP_SIZE);
+		if (free) return group * GROUP_SIZE + __builtin_ctz(free);
+		group = (group + step) & group_mask;
 	}
+}
+
+// Find the slot of a key in either index. Returns NULL if not found.
+HOT slot_t* find(hashtable_t *ht, hash_t hash)
+{
+	size_t idx = find_slot(&ht->index, hash);
+	if (idx != NO_SLOT) return get_slot(&ht->index, idx);
+
+	if (ht->old.ctrl && (idx = find_slot(&ht->old, hash)) != NO_SLOT)
+		return get_slot(&ht->old, idx);
 
 	return NULL;
 }
 
-/* -------------------------------------------------------------------------- */
+// Find the key at a position of the insertion order array, if it's current.
+static slot_t* find_ordered(hashtable_t *ht, size_t pos)
+{
+	slot_t *slot = find(ht, ht->order[pos]);
+	return slot && slot->order == pos ? slot : NULL;
+}
+
+static bool alloc_index(index_t *index, size_t capacity, size_t slot_size)
+{
+	index->capacity = capacity;
+	index->slot_size = slot_size;
+	index->ctrl = malloc(capacity);
+	index->slots = malloc(slot_size * capacity);
+	if (!index->ctrl || !index->slots) {
+		free(index->ctrl);
+		free(index->slots);
+		*index = (index_t){0};
+		return false;
+	}
 
-#define ENTRY_SIZE(ht) (sizeof(bucket_t) + (ht)->data_size)
+	memset(index->ctrl, CTRL_EMPTY, capacity);
+	return true;
+}
+
+static void free_index(index_t *index)
+{
+	free(index->ctrl);
+	free(index->slots);
+	*index = (index_t){0};
+}
+
+// Move up to `count` slots from the old index into the current one, and
+// free the old index once it is empty.
+static void migrate(hashtable_t *ht, size_t count)
+{
+	size_t end = ht->migrated + count;
+	if (end > ht->old.capacity) end = ht->old.capacity;
+
+	for (size_t idx = ht->migrated; idx < end; idx++) {
+		if (ht->old.ctrl[idx] & 0x80) continue;
+
+		slot_t *slot = get_slot(&ht->old, idx);
+		size_t dst = find_free_slot(&ht->index, slot->hash);
+		if (ht->index.ctrl[dst] == CTRL_DELETED) ht->deleted--;
+		ht->index.ctrl[dst] = ht->old.ctrl[idx];
+		memcpy(get_slot(&ht->index, dst), slot, ht->index.slot_size);
+
+		// Lookups still fall back to the old index, so the key must not be
+		// found there again. Keys further along its probe sequence must.
+		ht->old.ctrl[idx] = CTRL_DELETED;
+	}
+
+	ht->migrated = end;
+	if (end == ht->old.capacity) free_index(&ht->old);
+}
+
+/*
+	Start moving to a new index with `capacity` slots, dropping deleted slots.
+*/
+static bool rehash(hashtable_t *ht, size_t capacity)
+{
+	// Finish off any previous migration first; this only happens if the
+	// table is grown explicitly.
+	if (ht->old.ctrl) migrate(ht, ht->old.capacity);
+
+	index_t index;
+	if (!alloc_index(&index, capacity, ht->index.slot_size)) return false;
+
+	ht->old = ht->index;
+	ht->index = index;
+	ht->deleted = 0;
+	ht->migrated = 0;
+
+	migrate(ht, MIGRATE_SLOTS);
+	return true;
+}
+
+// Add a key to the end of the insertion order array. If the array is full
+// and at least half of it is stale, squeeze that out instead of growing it.
+static bool push_order(hashtable_t *ht, hash_t hash)
+{
+	if (ht->order_size == ht->order_capacity) {
+		if (ht->order_size > 0 && (ht->order_size - ht->count) * 2 >= ht->order_size) {
+			size_t dst = 0;
+			for (size_t src = 0; src < ht->order_size; src++) {
+				slot_t *slot = find_ordered(ht, src);
+				if (!slot) continue;
+				slot->order = dst;
+				ht->order[dst++] = ht->order[src];
+			}
+			ht->order_size = dst;
+		}
+		else {
+			size_t capacity = ht->order_capacity ? ht->order_capacity * 2 : 16;
+			hash_t *order = realloc(ht->order, sizeof(hash_t) * capacity);
+			if (!order) return false;
+
+			ht->order = order;
+			ht->order_capacity = capacity;
+		}
+	}
+
+	ht->order[ht->order_size++] = hash;
+	return true;
+}
+
+/* -------------------------------------------------------------------------- */
 
 hashtable_t* ht_alloc(size_t size, size_t val_size)
 {
-	hashtable_t *ht = malloc(sizeof(hashtable_t));
+	hashtable_t *ht = calloc(1, sizeof(hashtable_t));
 	if (!ht) return NULL;
 
-	ht->count = 0;
-	ht->size = size == 0 ? 16 : size;
 	ht->data_size = val_size;
 	ht->first_free = 1;
 
-	// There will always be room for at least ht->size entries in the table.
-	// As a consequence, LOAD_MAX must never be > 1.0.
-	ht->buckets = calloc(size, sizeof(bucket_t *));
-	ht->storage = mp_init(ht->size, ENTRY_SIZE(ht));
+	// Make room for `size` entries without rebuilding the index.
+	size_t capacity = GROUP_SIZE;
+	while (capacity * LOAD_NUM < size * LOAD_DEN) capacity *= 2;
 
-	if (!ht->buckets || !ht->storage) {
-		ht_free(ht);
+	if (!alloc_index(&ht->index, capacity, sizeof(slot_t) + ((val_size + 7) & ~(size_t)7))) {
+		free(ht);
 		return NULL;
 	}
 
-	memset(ht->buckets, 0, ht->size * sizeof(bucket_t *));
-
 	return ht;
 }
 
-void ht_free(hashtable_t *ht)
+bool ht_reserve(hashtable_t *ht, size_t count)
 {
-	assert(ht);
+	assert(ht && ht->index.ctrl);
 
-	// free the bucket array and the hashtable structure.
-	if (ht->buckets) free(ht->buckets);
-	if (ht->storage) mp_destroy(ht->storage);
-	free(ht);
-}
+	size_t capacity = ht->index.capacity;
+	while (capacity * LOAD_NUM < count * LOAD_DEN) capacity *= 2;
 
-/*
-	resize the bucket list and redistribute all items in the hash table
-	according to their new indexes
-*/
-static bool resize(hashtable_t *ht) {
-	// Resize the bucket list
-	size_t newsize = ht->size * 2;
-	bucket_t **ptr = realloc(ht->buckets, sizeof(bucket_t *) * newsize);
-	if (ptr == NULL) return false;
-
-	// zero the new bucket pointers
-	memset(ptr + ht->size, 0, (newsize - ht->size) * sizeof(bucket_t *));
-
-	ht->buckets = ptr;
-	ht->size = newsize;
-
-	// Size of the hashtable changed, so we need to rehash all the entries.
-	for (size_t idx = 0; idx < ht->size; idx++) {
-		// the entry before this one in the chain.
-		bucket_t *next = NULL;
-		// the current entry
-		bucket_t *entry = ht->buckets[idx];
-		while (entry != NULL) {
-			size_t n_idx = get_bucket_idx(ht, entry->hash);
-			// move the entry to its proper bucket.
-			if (n_idx != idx) {
-				// remove the entry from the current chain.
-				if (next == NULL) ht->buckets[idx] = entry->prev;
-				else next->prev = entry->prev;
-
-				// insert it into the other chain.
-				entry->prev = ht->buckets[n_idx];
-				ht->buckets[n_idx] = entry;
-
-				// reset with the new top of this bucket.
-				entry = next ? next->prev : ht->buckets[idx];
-			}
-			else {
-				// walk through the chain.
-				next = entry;
-				entry = entry->prev;
-			}
-		}
+	// There's no point in spreading the migration out when reserving ahead.
+	if (capacity > ht->index.capacity) {
+		if (!rehash(ht, capacity)) return false;
+		migrate(ht, ht->old.capacity);
+	}
+
+	if (count > ht->order_capacity) {
+		hash_t *order = realloc(ht->order, sizeof(hash_t) * count);
+		if (!order) return false;
+
+		ht->order = order;
+		ht->order_capacity = count;
 	}
 
 	return true;
 }
 
+void ht_free(hashtable_t *ht)
+{
+	assert(ht);
+
+	free(ht->order);
+	free_index(&ht->index);
+	free_index(&ht->old);
+	free(ht);
+}
+
 void* ht_insert(hashtable_t *ht, hash_t hash, void *data)
 {
-	assert(ht && ht->buckets && ht->storage);
+	assert(ht && ht->index.ctrl);
+
+	slot_t *slot = find(ht, hash);
+	if (!slot) {
+		if (ht->old.ctrl) migrate(ht, MIGRATE_SLOTS);
+
+		// Rebuild the index once it is 7/8 full, counting deleted slots. The
+		// new index is sized so the table fills at most 7/16 of it, plus one
+		// old index worth of inserts by the time the migration is done, so
+		// it never needs to grow again before that.
+		size_t used = ht->count + ht->deleted + 1;
+		if (used * LOAD_DEN > ht->index.capacity * LOAD_NUM) {
+			size_t capacity = ht->index.capacity;
+			while ((ht->count + 1) * LOAD_DEN * 2 > capacity * LOAD_NUM) capacity *= 2;
+			if (!rehash(ht, capacity)) return NULL;
+		}
 
-	if (ht->count > 0 && (float)ht->count / ht->size > LOAD_MAX) {
-		if (!resize(ht)) return NULL;
-	}
+		if (!push_order(ht, hash)) return NULL;
 
-	// Get the bucket.
-	const size_t bucket = get_bucket_idx(ht, hash);
-	// If we don't have this hash stored already...
-	bucket_t *entry = get_entry(ht, hash);
-	if (!entry) {
-		bucket_t *ptr = mp_alloc(ht->storage);
-		if (!ptr) return NULL;
-		memset((void *)ptr, 0, ENTRY_SIZE(ht));
-		ptr->prev = ht->buckets[bucket];
-		entry = ht->buckets[bucket] = ptr;
+		size_t idx = find_free_slot(&ht->index, hash);
+		if (ht->index.ctrl[idx] == CTRL_DELETED) ht->deleted--;
+		ht->index.ctrl[idx] = ctrl_hash(hash);
 		ht->count++;
+
+		slot = get_slot(&ht->index, idx);
+		slot->hash = hash;
+		slot->order = ht->order_size - 1;
 	}
 
-	entry->hash = hash;
 	if (data)
-		memcpy(entry->data, data, ht->data_size);
+		memcpy(slot->data, data, ht->data_size);
 	else
-		memset(entry->data, 0, ht->data_size);
+		memset(slot->data, 0, ht->data_size);
 
 	// Update the first_free ptr if necessary.
 	if (ht->first_free == hash) ht->first_free = ht_next_free(ht, hash);
 
 	// Return the pointer to the new data.
-	return entry->data;
+	return slot->data;
 }
 
 void* ht_get(hashtable_t *ht, hash_t hash)
 {
-	bucket_t *ht_ent = get_entry(ht, hash);
-	return ht_ent ? ht_ent->data : NULL;
+	slot_t *slot = find(ht, hash);
+	return slot ? slot->data : NULL;
 }
 
 size_t ht_len(hashtable_t *ht)
@@ -191,84 +417,105 @@ size_t ht_len(hashtable_t *ht)
 	return ht->count;
 }
 
-// Get the next hashtable entry after the current.
-// Calling the function with hash = 0 gets the first entry,
+// Get the next hashtable entry after the current, in insertion order.
+// Calling the function with hash = 0 gets the first entry.
 hash_t ht_next(hashtable_t *ht, hash_t hash)
 {
-	assert(ht && ht->buckets && ht->storage);
+	assert(ht && ht->index.ctrl);
 
 	// If there are no more entries in the table, skip out early.
 	if (ht->count < 1) return 0;
 
-	size_t idx = get_bucket_idx(ht, hash);
-	if (ht->buckets[idx]) {
-		// If we have a bucket and our start hash is not at the end of the bucket:
-		if (ht->buckets[idx]->hash != hash) {
-			bucket_t *entry = ht->buckets[idx];
-			// Find the hash and return the one after it.
-			while (entry->prev) {
-				if (entry->prev->hash == hash) return entry->hash;
-				entry = entry->prev;
+	size_t pos = 0;
+	if (hash != 0) {
+		slot_t *current = find(ht, hash);
+		if (current) {
+			pos = current->order + 1;
+		}
+		else {
+			// The key may have been deleted while iterating; its position
+			// stays in the array until the array is squeezed.
+			for (size_t idx = ht->order_size; idx-- > 0;) {
+				if (ht->order[idx] == hash) {
+					pos = idx + 1;
+					break;
+				}
 			}
-
-			// If the starting hash is not in the table, return the first in
-			// the appropriate bucket.
-			return entry->hash;
 		}
-		// If the starting index is the end of the bucket, find the next bucket.
-		else idx++;
 	}
 
-	// If we don't have a bucket, walk the hashtable until we find one.
-	// Then, get the first entry in the bucket.
-	for (size_t n_idx = idx; n_idx < ht->size; n_idx++) {
-		if (ht->buckets[n_idx]) {
-			WALK_BACKWARDS(ht, n_idx, !ent->prev);
-			return ent->hash;
-		}
+	for (; pos < ht->order_size; pos++) {
+		if (ht->order[pos] != 0 && find_ordered(ht, pos)) return ht->order[pos];
 	}
 
 	return 0;
 }
 
+ht_iter_t ht_iter_begin(hashtable_t *ht)
+{
+	assert(ht);
+
+	return (ht_iter_t){ ht, 0, 0, NULL };
+}
+
+bool ht_iter_next(ht_iter_t *iter)
+{
+	hashtable_t *ht = iter->ht;
+	while (iter->pos < ht->order_size) {
+		slot_t *slot = find_ordered(ht, iter->pos++);
+		if (!slot) continue;
+
+		iter->key = slot->hash;
+		iter->value = slot->data;
+		return true;
+	}
+
+	return false;
+}
+
 hash_t ht_get_free(hashtable_t *ht)
 {
-	assert(ht && ht->buckets && ht->storage);
+	assert(ht && ht->index.ctrl);
 
 	return ht->first_free;
 }
 
 hash_t ht_next_free(hashtable_t *ht, hash_t idx)
 {
-	assert(ht && ht->buckets && ht->storage);
+	assert(ht && ht->index.ctrl);
 
-	while(get_entry(ht, ++idx)) continue;
+	while (find(ht, ++idx)) continue;
 	return idx;
 }
 
 void ht_delete(hashtable_t *ht, hash_t hash)
 {
-	assert(ht && ht->buckets && ht->storage);
-
-	size_t idx = get_bucket_idx(ht, hash);
-	bucket_t *entry = get_entry(ht, hash);
-	if (!entry) return;
+	assert(ht && ht->index.ctrl);
 
-	if (ht->buckets[idx] == entry) {
-		// Remove this entity from the chain.
-		ht->buckets[idx] = entry->prev;
+	index_t *index = &ht->index;
+	size_t idx = find_slot(index, hash);
+	if (idx == NO_SLOT && ht->old.ctrl) {
+		index = &ht->old;
+		idx = find_slot(index, hash);
+	}
+	if (idx == NO_SLOT) return;
+
+	// A group with an empty slot has never been full, so no lookup probes
+	// past it and the slot can be emptied outright. Otherwise, it has to
+	// stay in the way as deleted. Deleted slots in the old index are never
+	// moved, so they need no count.
+	const uint8_t *group = index->ctrl + idx / GROUP_SIZE * GROUP_SIZE;
+	if (match_byte(group, CTRL_EMPTY)) {
+		index->ctrl[idx] = CTRL_EMPTY;
 	}
 	else {
-		// Get the next entry in the chain.
-		WALK_BACKWARDS(ht, idx, ent->prev == entry);
-		// Remove this entry.
-		ent->prev = entry->prev;
+		index->ctrl[idx] = CTRL_DELETED;
+		if (index == &ht->index) ht->deleted++;
 	}
-
-	// Deallocate the block.
-	mp_free(ht->storage, entry);
 	ht->count--;
 
+	if (ht->old.ctrl) migrate(ht, MIGRATE_SLOTS);
+
 	// Update the first_free ptr if we're deleting something below it.
 	if (ht->first_free > hash && hash != 0) ht->first_free = hash;
 }
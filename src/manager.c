@@ -1,6 +1,6 @@
 #include "manager.h"
 
-int string_arr_to_type(hash_t **dst, const char **src)
+int string_arr_to_type(hash_t **dst, bool **read_only, const char **src)
 {
     if (!dst || !src) return -1;
 
@@ -10,9 +10,25 @@ int string_arr_to_type(hash_t **dst, const char **src)
     hash_t *ptr = calloc(idx, sizeof(hash_t));
     if (!ptr) return -1;
 
+    bool *flags = NULL;
+    if (read_only) {
+        flags = calloc(idx, sizeof(bool));
+        if (!flags) {
+            free(ptr);
+            return -1;
+        }
+        *read_only = flags;
+    }
+
     *dst = ptr;
+    const size_t prefix = strlen(COMPONENT_READ_PREFIX);
     for (size_t _i = 0; _i < idx; _i++) {
-        ptr[_i] = hash_string(src[_i]);
+        const char *name = src[_i];
+        if (flags && strncmp(name, COMPONENT_READ_PREFIX, prefix) == 0) {
+            flags[_i] = true;
+            name += prefix;
+        }
+        ptr[_i] = hash_string(name);
     }
 
     return idx;
@@ -23,7 +39,26 @@ ComponentType* Manager_GetComponentType(ECS *ecs, hash_t type)
 {
 	assert(ecs);
 
-	return ht_get(ecs->cm_types, type);
+	ComponentType **ptr = ht_get(ecs->cm_types, type);
+	return ptr ? *ptr : NULL;
+}
+
+// Restride the entity signatures to `words` words per entity. This only
+// happens when the number of component types crosses a word boundary.
+static bool resize_signatures(EntityRegistry *reg, uint32_t words)
+{
+	bitset_t *ptr = calloc((size_t)words * reg->capacity, sizeof(bitset_t));
+	if (!ptr) return false;
+
+	for (uint32_t idx = 0; idx < reg->size; idx++) {
+		memcpy(&ptr[idx * words], &reg->signatures[idx * reg->sig_words],
+			sizeof(bitset_t) * reg->sig_words);
+	}
+
+	free(reg->signatures);
+	reg->signatures = ptr;
+	reg->sig_words = words;
+	return true;
 }
 
 // Registers a new component type.
@@ -31,13 +66,47 @@ bool Manager_RegisterComponentType(ECS *ecs, ComponentType *type)
 {
 	assert(ecs && ecs->cm_types && type);
 
-	type = ht_insert(ecs->cm_types, type->type_hash, type);
-	if (type == NULL) return false;
+	// Make room for the new type index in the entity signatures.
+	type->type_idx = ecs->type_list.size;
+	uint32_t words = BITSET_WORDS(type->type_idx + 1);
+	if (words > ecs->entities.sig_words && !resize_signatures(&ecs->entities, words))
+		return false;
+
+	// The table moves its values around, so it only holds a pointer to the
+	// type; the type itself stays put for type_list and the archetypes.
+	ComponentType *ptr = malloc(sizeof(ComponentType));
+	if (!ptr) return false;
+	*ptr = *type;
+	type = ptr;
+	if (!ht_insert(ecs->cm_types, type->type_hash, &type)) {
+		free(type);
+		return false;
+	}
+	dyn_append(&ecs->type_list, &type);
 
-	type->components = ht_alloc(ecs->alloc_info.components, type->type_size);
-	if (!type->components) {
+	if (!dyn_alloc(&type->systems, 4, sizeof(System *))) {
 		free((char *)type->type);
+		dyn_delete(&ecs->type_list, -1);
 		ht_delete(ecs->cm_types, type->type_hash);
+		free(type);
+		return false;
+	}
+
+	// Chunked components are stored in their entity's archetype instead.
+	if (type->storage == ComponentStorageChunked) return true;
+
+	bool ok;
+	if (type->storage == ComponentStorageSparse)
+		ok = (type->sparse = ss_alloc(ecs->alloc_info.components, type->type_size)) != NULL;
+	else
+		ok = (type->components = ht_alloc(ecs->alloc_info.components, type->type_size)) != NULL;
+
+	if (!ok) {
+		free((char *)type->type);
+		dyn_free(&type->systems);
+		dyn_delete(&ecs->type_list, -1);
+		ht_delete(ecs->cm_types, type->type_hash);
+		free(type);
 		return false;
 	}
 
@@ -52,16 +121,61 @@ bool Manager_HasComponentType(ECS *ecs, hash_t type)
 	return ht_get(ecs->cm_types, type) ? true : false;
 }
 
+// Move an entity to the archetype with (or without) a chunked component.
+static Component* move_chunked(ECS *ecs, ComponentType *type, hash_t id, bool add)
+{
+	EntityRecord *rec = Manager_GetEntity(ecs, id);
+	if (!rec) return NULL;
+
+	Archetype *dst = add ? Archetype_With(ecs, rec->archetype, type)
+		: Archetype_Without(ecs, rec->archetype, type);
+	if (add && !dst) return NULL;
+	if (!Archetype_Move(ecs, id, rec, dst)) return NULL;
+
+	return add ? Archetype_GetComponent(dst, rec, Archetype_Column(dst, type->type_hash)) : NULL;
+}
+
 Component* Manager_CreateComponent(ECS *ecs, ComponentType *type, hash_t id)
+{
+	return Manager_CreateComponentFrom(ecs, type, id, NULL);
+}
+
+// Insert a component into (or delete it from) the storage of a type that
+// isn't chunked.
+static Component* insert_component(ComponentType *type, hash_t id, const void *data)
+{
+	if (type->storage == ComponentStorageSparse)
+		return ss_insert(type->sparse, ENTITY_INDEX(id), (void *)data);
+
+	return ht_insert(type->components, id, (void *)data);
+}
+
+static void remove_component(ComponentType *type, hash_t id)
+{
+	if (type->storage == ComponentStorageSparse)
+		ss_delete(type->sparse, ENTITY_INDEX(id));
+	else
+		ht_delete(type->components, id);
+}
+
+Component* Manager_CreateComponentFrom(ECS *ecs, ComponentType *type, hash_t id, const void *data)
 {
 	assert(ecs && type);
 
 	// Create the component
-	Component *comp = ht_insert(type->components, id, NULL);
+	Component *comp;
+	if (type->storage == ComponentStorageChunked) {
+		comp = move_chunked(ecs, type, id, true);
+		if (comp && data) memcpy(comp, data, type->type_size);
+	}
+	else {
+		comp = insert_component(type, id, data);
+	}
 	if (!comp) return NULL;
+	bs_set(Manager_EntitySignature(ecs, id), type->type_idx);
 
-	// And run the creation function.
-	if (type->cr_func) type->cr_func(comp);
+	// And run the creation function, unless we were handed the contents.
+	if (!data && type->cr_func) type->cr_func(comp);
 
 	return comp;
 }
@@ -70,55 +184,344 @@ Component* Manager_GetComponent(ECS *ecs, ComponentType *type, hash_t id)
 {
 	assert(ecs);
 
-	return ht_get(type->components, id);
+	if (type->storage == ComponentStorageSparse)
+		return ss_get(type->sparse, ENTITY_INDEX(id));
+	if (type->storage != ComponentStorageChunked)
+		return ht_get(type->components, id);
+
+	EntityRecord *rec = Manager_GetEntity(ecs, id);
+	if (!rec || !rec->archetype) return NULL;
+
+	int col = Archetype_Column(rec->archetype, type->type_hash);
+	return col < 0 ? NULL : Archetype_GetComponent(rec->archetype, rec, col);
 }
 
 Component* Manager_GetComponentByID(ECS *ecs, ComponentID id)
 {
 	assert(ecs);
 
-	ComponentType *cm_type = ht_get(ecs->cm_types, id.type);
+	ComponentType *cm_type = Manager_GetComponentType(ecs, id.type);
 	if (!cm_type) return NULL;
 
-	return ht_get(cm_type->components, id.id);
+	return Manager_GetComponent(ecs, cm_type, id.id);
 }
 
 void Manager_DeleteComponent(ECS *ecs, ComponentType *type, hash_t id)
 {
-	assert(ecs && type && type->components);
+	assert(ecs && type);
 
-	Component *comp = ht_get(type->components, id);
+	Component *comp = Manager_GetComponent(ecs, type, id);
 	if (!comp) return;
 
 	// Call the dtor.
 	if (type->dl_func) type->dl_func(comp);
+	bs_clear(Manager_EntitySignature(ecs, id), type->type_idx);
 
 	// Delete the component and it's data.
-	ht_delete(type->components, id);
+	if (type->storage == ComponentStorageChunked)
+		move_chunked(ecs, type, id, false);
+	else
+		remove_component(type, id);
+}
+
+Component* Manager_StoreComponent(ComponentType *type, hash_t id, const void *data)
+{
+	assert(type && type->storage != ComponentStorageChunked);
+
+	Component *comp = insert_component(type, id, data);
+	if (comp && !data && type->cr_func) type->cr_func(comp);
+
+	return comp;
+}
+
+void Manager_UnstoreComponent(ComponentType *type, hash_t id)
+{
+	assert(type && type->storage != ComponentStorageChunked);
+
+	Component *comp = type->storage == ComponentStorageSparse
+		? ss_get(type->sparse, ENTITY_INDEX(id)) : ht_get(type->components, id);
+	if (!comp) return;
+
+	if (type->dl_func) type->dl_func(comp);
+	remove_component(type, id);
+}
+
+bool Manager_ApplyComponents(ECS *ecs, Entity entity, ComponentType **add, const void **add_data,
+	uint32_t num_add, ComponentType **remove, uint32_t num_remove)
+{
+	assert(ecs && (add || !num_add) && (remove || !num_remove));
+
+	EntityRecord *rec = Manager_GetEntity(ecs, entity);
+	if (!rec) return false;
+
+	bitset_t *signature = Manager_EntitySignature(ecs, entity);
+	bool ok = true;
+
+	// Chunked components are collected, and moved all at once.
+	Archetype *src = rec->archetype;
+	uint32_t src_size = src ? src->size : 0;
+	ComponentType *chunked[src_size + num_add + 1];
+	const void *chunked_data[src_size + num_add + 1];
+	uint32_t num_chunked = 0;
+	bool move = false;
+
+	for (uint32_t idx = 0; idx < num_remove; idx++) {
+		ComponentType *type = remove[idx];
+		if (!bs_get(signature, type->type_idx)) continue;
+
+		if (type->storage != ComponentStorageChunked) {
+			Manager_DeleteComponent(ecs, type, entity);
+			continue;
+		}
+
+		if (type->dl_func) type->dl_func(Manager_GetComponent(ecs, type, entity));
+		bs_clear(signature, type->type_idx);
+		move = true;
+	}
+
+	// The removed chunked components have been cleared from the signature.
+	for (uint32_t col = 0; col < src_size; col++) {
+		if (bs_get(signature, src->types[col]->type_idx)) chunked[num_chunked++] = src->types[col];
+	}
+
+	uint32_t first_added = num_chunked;
+	for (uint32_t idx = 0; idx < num_add; idx++) {
+		ComponentType *type = add[idx];
+		const void *data = add_data ? add_data[idx] : NULL;
+
+		// Existing components are only overwritten when given new contents.
+		if (bs_get(signature, type->type_idx)) {
+			if (!data) continue;
+
+			Component *comp = Manager_GetComponent(ecs, type, entity);
+			if (type->dl_func) type->dl_func(comp);
+			memcpy(comp, data, type->type_size);
+			continue;
+		}
+
+		if (type->storage != ComponentStorageChunked) {
+			ok &= Manager_CreateComponentFrom(ecs, type, entity, data) != NULL;
+			continue;
+		}
+
+		// Skip duplicates in the list of added components.
+		bool duplicate = false;
+		for (uint32_t prev = first_added; prev < num_chunked; prev++)
+			duplicate |= chunked[prev] == type;
+		if (!duplicate) {
+			chunked_data[num_chunked] = data;
+			chunked[num_chunked++] = type;
+		}
+		move = true;
+	}
+
+	if (move) {
+		ComponentType *added[num_chunked - first_added + 1];
+		const void **added_data = chunked_data + first_added;
+		uint32_t num_added = num_chunked - first_added;
+		memcpy(added, chunked + first_added, sizeof(ComponentType *) * num_added);
+
+		Archetype_SortTypes(chunked, num_chunked);
+		Archetype *dst = num_chunked ? Archetype_Get(ecs, chunked, num_chunked) : NULL;
+
+		if ((!num_chunked || dst) && Archetype_Move(ecs, entity, rec, dst)) {
+			for (uint32_t idx = 0; idx < num_added; idx++) {
+				ComponentType *type = added[idx];
+				Component *comp = Manager_GetComponent(ecs, type, entity);
+				bs_set(signature, type->type_idx);
+
+				if (added_data[idx]) memcpy(comp, added_data[idx], type->type_size);
+				else if (type->cr_func) type->cr_func(comp);
+			}
+		}
+		else {
+			ok = false;
+		}
+	}
+
+	// Now that the entity has its final set of components, update the
+	// collections of the systems that may have been affected.
+	for (uint32_t idx = 0; idx < num_remove; idx++)
+		Manager_UpdateCollections(ecs, entity, remove[idx]);
+	for (uint32_t idx = 0; idx < num_add; idx++)
+		Manager_UpdateCollections(ecs, entity, add[idx]);
+
+	return ok;
 }
 
 /* -------------------------------------------------------------------------- */
 
-// An entity is literally a 32-bit integer. We drop it in the entity list for
-// reasons that need to be re-evaluated.
+// Grow the record and signature arrays to hold `capacity` entities.
+static bool grow_records(EntityRegistry *reg, size_t capacity)
+{
+	EntityRecord *ptr = realloc(reg->records, sizeof(EntityRecord) * capacity);
+	ERR_RET_ZERO(ptr, "Error creating entity: out of memory.\n");
+	reg->records = ptr;
+
+	bitset_t *sig = realloc(reg->signatures, sizeof(bitset_t) * reg->sig_words * capacity);
+	ERR_RET_ZERO(sig, "Error creating entity: out of memory.\n");
+	reg->signatures = sig;
+
+	reg->capacity = capacity;
+	return true;
+}
+
+bool Manager_InitEntities(ECS *ecs, size_t capacity)
+{
+	EntityRegistry *reg = &ecs->entities;
+	if (capacity == 0) capacity = 16;
+
+	reg->records = malloc(sizeof(EntityRecord) * capacity);
+	reg->size = 0;
+	reg->capacity = capacity;
+	reg->count = 0;
+	reg->free_head = ENTITY_FREE_END;
+	reg->next_index = 0;
+
+	reg->sig_words = 1;
+	reg->signatures = malloc(sizeof(bitset_t) * reg->sig_words * capacity);
+
+	return reg->records && reg->signatures;
+}
+
+bool Manager_ReserveEntities(ECS *ecs, size_t count)
+{
+	EntityRegistry *reg = &ecs->entities;
+	if (count > ENTITY_INDEX_MASK + 1) count = ENTITY_INDEX_MASK + 1;
+	if (count > reg->capacity && !grow_records(reg, count)) return false;
+
+	// Systems index their entity queues by entity index.
+	HT_ITER(ecs->systems, it) {
+		System *system = *(System **)it.value;
+		if (!system->is_chunked && !ha_reserve(system->ent_queue, count)) return false;
+	}
+
+	return true;
+}
+
+bool Manager_ReserveComponents(ECS *ecs, ComponentType *type, size_t count)
+{
+	assert(ecs && type);
+
+	// Chunks are sized per archetype, so chunked types have nothing to grow.
+	if (type->sparse) return ss_reserve(type->sparse, count);
+	if (type->components) return ht_reserve(type->components, count);
+	return true;
+}
+
+// Make sure the registry has initialized records up to and including idx.
+// Records that were reserved but not created yet are neither alive nor free.
+static bool ensure_records(EntityRegistry *reg, uint32_t idx)
+{
+	if (idx < reg->size) return true;
+
+	if (idx >= reg->capacity) {
+		size_t capacity = reg->capacity * 2;
+		while (capacity <= idx) capacity *= 2;
+		if (!grow_records(reg, capacity)) return false;
+	}
+
+	for (uint32_t rec_idx = reg->size; rec_idx <= idx; rec_idx++) {
+		EntityRecord *rec = &reg->records[rec_idx];
+		rec->generation = 1;
+		rec->next_free = ENTITY_FREE_END;
+		rec->alive = false;
+	}
+
+	reg->size = idx + 1;
+	return true;
+}
+
+// Invalidate outstanding handles to a record and put it on the free list.
 //
-// It might be possible to replace the entity list with a simple gap-spanning
-// tracker for free IDs. This would make entity deletion slightly more complex,
-// but would likely significantly reduce the amount of complexity and memory
-// required to create and manage entities.
+// Generations don't wrap around: a stale handle would become valid again for
+// an unrelated entity. Once an index has used up its generations, it is
+// retired and never handed out again.
+static void free_record(EntityRegistry *reg, uint32_t idx)
+{
+	EntityRecord *rec = &reg->records[idx];
+	rec->alive = false;
+	if (rec->generation == ENTITY_MAX_GENERATION) return;
+
+	rec->generation++;
+	rec->next_free = reg->free_head;
+	reg->free_head = idx;
+}
+
+// Freed records are reused first, most recently freed first, before taking
+// an index that has never been used.
+//
+// Records are only ever pushed onto the free list while no systems are
+// updating, so concurrent reservations only pop records off the list, and
+// a compare-and-swap on the head is enough.
+Entity Manager_ReserveEntity(ECS *ecs)
+{
+	assert(ecs);
+
+	EntityRegistry *reg = &ecs->entities;
+	uint32_t idx = __atomic_load_n(&reg->free_head, __ATOMIC_ACQUIRE);
+	while (idx != ENTITY_FREE_END) {
+		uint32_t next = reg->records[idx].next_free;
+		if (__atomic_compare_exchange_n(&reg->free_head, &idx, next, true,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return ENTITY_MAKE(idx, reg->records[idx].generation);
+	}
+
+	idx = __atomic_fetch_add(&reg->next_index, 1, __ATOMIC_RELAXED);
+	ERR_RET_ZERO(idx <= ENTITY_INDEX_MASK, "Error creating entity: out of entity indexes.\n");
+
+	// Fresh records always start at generation 1.
+	return ENTITY_MAKE(idx, 1);
+}
+
+bool Manager_CreateReservedEntity(ECS *ecs, Entity entity)
+{
+	assert(ecs && entity);
+
+	EntityRegistry *reg = &ecs->entities;
+	uint32_t idx = ENTITY_INDEX(entity);
+	if (!ensure_records(reg, idx)) return false;
+
+	EntityRecord *rec = &reg->records[idx];
+	assert(!rec->alive && rec->generation == ENTITY_GENERATION(entity));
+
+	rec->archetype = NULL;
+	rec->chunk = rec->row = 0;
+	rec->next_free = ENTITY_FREE_END;
+	rec->alive = true;
+	reg->count++;
+
+	memset(Manager_EntitySignature(ecs, entity), 0, sizeof(bitset_t) * reg->sig_words);
+	return true;
+}
+
+void Manager_ReleaseEntity(ECS *ecs, Entity entity)
+{
+	assert(ecs && entity);
+
+	EntityRegistry *reg = &ecs->entities;
+	if (!ensure_records(reg, ENTITY_INDEX(entity))) return;
+
+	assert(!reg->records[ENTITY_INDEX(entity)].alive);
+	free_record(reg, ENTITY_INDEX(entity));
+}
+
+// An entity is an index into the entity registry, plus the generation of the
+// record at that index, so both creation and deletion are O(1).
 //
 // This function should not be called from a thread that does not have a lock
 // on the entity list.
-//
-// Due to the time cost of acquiring a lock, locking should be performed in a
-// higher-level logic structure, preferably one that handles creating multiple
-// entities at once.
 Entity Manager_CreateEntity(ECS *ecs)
 {
 	assert(ecs);
 
-    hash_t entity;
-    (void) ha_insert_free(ecs->entities, &entity, NULL);
+	Entity entity = Manager_ReserveEntity(ecs);
+	if (!entity) return 0;
+
+	if (!Manager_CreateReservedEntity(ecs, entity)) {
+		Manager_ReleaseEntity(ecs, entity);
+		return 0;
+	}
 
 	return entity;
 }
@@ -129,21 +532,44 @@ void Manager_DeleteEntity(ECS *ecs, Entity entity)
 {
 	assert(ecs);
 
-	// Because we don't keep state on the entity, we iterate through all
-	// possible components and delete the ones matching the entity.
-	HT_FOR(ecs->cm_types) {
-		ComponentType *cm_type = ht_get(ecs->cm_types, idx);
-		if (ht_get(cm_type->components, entity))
-			Manager_DeleteComponent(ecs, cm_type, entity);
+	EntityRecord *rec = Manager_GetEntity(ecs, entity);
+	if (!rec) return;
+
+	bitset_t *signature = Manager_EntitySignature(ecs, entity);
+	const uint32_t sig_words = ecs->entities.sig_words;
+
+	// Remove the entity from the queues of the systems it matches, while we
+	// still have its full signature. Only systems operating on one of the
+	// entity's components can match it.
+	BS_FOR(signature, sig_words) {
+		ComponentType *cm_type = *(ComponentType **)dyn_get(&ecs->type_list, bit);
+		DYN_FOR(cm_type->systems, 0) {
+			System *system = *(System **)dyn_get(&cm_type->systems, idx);
+			if (system->is_chunked) continue;
+			if (bs_subset(system->signature, system->sig_words, signature, sig_words))
+				ha_delete(system->ent_queue, ENTITY_INDEX(entity));
+		}
 	}
 
-	// Remove the entity from system queues.
-	HT_FOR(ecs->systems) {
-		System *system = ht_get(ecs->systems, idx);
-		ha_delete(system->ent_queue, entity);
+	// Chunked components are all stored in the entity's archetype.
+	Archetype *arch = rec->archetype;
+	if (arch) {
+		for (uint32_t col = 0; col < arch->size; col++) {
+			ComponentType *cm_type = arch->types[col];
+			if (cm_type->dl_func) cm_type->dl_func(Archetype_GetComponent(arch, rec, col));
+		}
+		Archetype_Move(ecs, entity, rec, NULL);
+	}
+
+	// Only visit the component types the entity actually has.
+	BS_FOR(signature, sig_words) {
+		ComponentType *cm_type = *(ComponentType **)dyn_get(&ecs->type_list, bit);
+		if (cm_type->storage == ComponentStorageChunked) continue;
+		Manager_DeleteComponent(ecs, cm_type, entity);
 	}
 
-    ha_delete(ecs->entities, entity);
+	ecs->entities.count--;
+	free_record(&ecs->entities, ENTITY_INDEX(entity));
 }
 
 /* -------------------------------------------------------------------------- */
@@ -152,26 +578,89 @@ bool Manager_RegisterSystem(ECS *ecs, System *info)
 {
 	assert(ecs && ecs->systems && info);
 
+	// The signature needs every component type to be registered, otherwise
+	// the system would match entities that lack some of its components.
+	for (size_t idx = 0; info->archetype && idx < info->archetype->size; idx++) {
+		hash_t id = info->archetype->components[idx];
+		if (!Manager_HasComponentType(ecs, id)) {
+			ECS_ERROR(ecs, "Error registering system %s: unknown component type %08x.", info->name, id);
+			return false;
+		}
+	}
+
 	info->ent_queue = ha_alloc(128, sizeof(hash_t));
     ERR_RET_ZERO(info->ent_queue, "Error creating system entity queue.\n");
 
-	System *_info = ht_insert(ecs->systems, hash_string(info->name), info);
-
-    // Circular references in the dependencies cause undefined behavior
-    // TODO: this is a simplistic implementation that does not handle
-    // dependencies very well. Improve this.
-    size_t first_insert = 0;
-    size_t last_insert = ecs->system_order.size;
-    for (size_t idx = 0; idx < ecs->system_order.size; idx++) {
-        System *system = (System *)dyn_get(&ecs->system_order, idx);
-        if (system->dependencies && hs_get(system->dependencies, info->name_hash))
-            if (idx < last_insert) last_insert = idx;
-        if (info->dependencies && hs_get(info->dependencies, system->name_hash))
-            first_insert = idx;
-    }
+	// Systems operating only on chunked components iterate archetypes.
+	info->is_chunked = info->archetype && info->archetype->size > 0;
+	for (size_t idx = 0; info->is_chunked && idx < info->archetype->size; idx++) {
+		ComponentType *type = Manager_GetComponentType(ecs, info->archetype->components[idx]);
+		info->is_chunked = type && type->storage == ComponentStorageChunked;
+	}
+
+	ERR_RET_ZERO(dyn_alloc(&info->archetypes, 8, sizeof(Archetype *)),
+		"Error creating system archetype list.\n");
+
+	// Build the system's signature from its archetype.
+	info->signature = info->reads = info->writes = NULL;
+	info->types = NULL;
+	info->sig_words = 0;
+	if (info->archetype && info->archetype->size > 0) {
+		info->sig_words = ecs->entities.sig_words;
+		info->signature = calloc(info->sig_words * 3, sizeof(bitset_t));
+		ERR_RET_ZERO(info->signature, "Error creating system signature.\n");
+		info->reads = info->signature + info->sig_words;
+		info->writes = info->reads + info->sig_words;
+
+		info->types = malloc(sizeof(ComponentType *) * info->archetype->size);
+		ERR_RET_ZERO(info->types, "Error creating system type list.\n");
+
+		for (size_t idx = 0; idx < info->archetype->size; idx++) {
+			ComponentType *type = Manager_GetComponentType(ecs, info->archetype->components[idx]);
+			info->types[idx] = type;
+			bs_set(info->signature, type->type_idx);
+			bs_set(info->archetype->read_only[idx] ? info->reads : info->writes, type->type_idx);
+		}
+	}
+
+	// Systems are referenced from all over, so the table only holds pointers.
+	System *_info = malloc(sizeof(System));
+	if (_info) {
+		*_info = *info;
+		if (!ht_insert(ecs->systems, _info->name_hash, &_info)) {
+			free(_info);
+			_info = NULL;
+		}
+	}
+
+	if (_info && _info->is_chunked) {
+		HT_ITER(ecs->archetypes, it) {
+			Archetype *arch = *(Archetype **)it.value;
+			if (Archetype_HasTypes(arch, _info->archetype->components, _info->archetype->size))
+				dyn_append(&_info->archetypes, &arch);
+		}
+	}
+
+	if (_info && _info->sig_words > 0) {
+		// Index the system under each of its component types.
+		BS_FOR(_info->signature, _info->sig_words) {
+			ComponentType *type = *(ComponentType **)dyn_get(&ecs->type_list, bit);
+			dyn_append(&type->systems, &_info);
+		}
+
+		// Queue the entities that already match the system.
+		for (uint32_t idx = 0; !_info->is_chunked && idx < ecs->entities.size; idx++) {
+			EntityRecord *rec = &ecs->entities.records[idx];
+			if (!rec->alive) continue;
+
+			Entity entity = ENTITY_MAKE(idx, rec->generation);
+			if (Manager_ShouldSystemQueueEntity(ecs, _info, entity))
+				ha_insert(_info->ent_queue, idx, &entity);
+		}
+	}
 
-    size_t insert = first_insert > last_insert ? first_insert : last_insert;
-    dyn_insert(&ecs->system_order, insert, &_info);
+    // Dependencies between systems are resolved by ECS_ArrangeSystems.
+    if (_info) dyn_append(&ecs->system_order, &_info);
 
     ecs->update_systems_dirty = true;
 
@@ -182,7 +671,8 @@ System* Manager_GetSystem(ECS *ecs, const char *name)
 {
 	assert(ecs && ecs->systems && name);
 
-	return ht_get(ecs->systems, hash_string(name));
+	System **system = ht_get(ecs->systems, hash_string(name));
+	return system ? *system : NULL;
 }
 
 void Manager_UnregisterSystem(ECS *ecs, System *system)
@@ -193,11 +683,31 @@ void Manager_UnregisterSystem(ECS *ecs, System *system)
     dyn_remove(&ecs->system_order, idx, false);
     ecs->update_systems_dirty = true;
 
+	if (system->sig_words > 0) {
+		BS_FOR(system->signature, system->sig_words) {
+			ComponentType *type = *(ComponentType **)dyn_get(&ecs->type_list, bit);
+			int sys_idx = dyn_find(&type->systems, &system);
+			if (sys_idx >= 0) dyn_remove(&type->systems, sys_idx, true);
+		}
+	}
+
+	if (system->subscriptions.ptr) {
+		while (system->subscriptions.size > 0)
+			Manager_Unsubscribe(ecs, system, *(hash_t *)dyn_get(&system->subscriptions, -1));
+		dyn_free(&system->subscriptions);
+	}
+
+	Manager_CollectEvents(system);
 	EventQueue_Free(system->ev_queue);
+	if (system->dependencies) hs_free(system->dependencies);
 	free((char *)system->name);
 	ha_free(system->ent_queue);
+	dyn_free(&system->archetypes);
+	free(system->signature);
+	free(system->types);
 
 	ht_delete(ecs->systems, system->name_hash);
+	free(system);
 }
 
 void Manager_ArrangeSystems(ECS *ecs)
@@ -205,15 +715,23 @@ void Manager_ArrangeSystems(ECS *ecs)
 
 }
 
-void Manager_UpdateCollections(ECS *ecs, Entity entity)
+void Manager_UpdateCollections(ECS *ecs, Entity entity, ComponentType *type)
 {
-	HT_FOR(ecs->systems) {
-		System *system = ht_get(ecs->systems, idx);
+	assert(ecs && type);
+
+	DYN_FOR(type->systems, 0) {
+		System *system = *(System **)dyn_get(&type->systems, idx);
+		// Chunked systems find their entities through their archetypes.
+		if (system->is_chunked) continue;
+
+		// Entity queues are indexed by entity index, and store the handle.
+		hash_t queue_idx = ENTITY_INDEX(entity);
 		if (Manager_ShouldSystemQueueEntity(ecs, system, entity)) {
-			ha_insert_free(system->ent_queue, NULL, &entity);
+			if (!ha_get(system->ent_queue, queue_idx))
+				ha_insert(system->ent_queue, queue_idx, &entity);
 		}
 		else {
-			ha_delete(system->ent_queue, entity);
+			ha_delete(system->ent_queue, queue_idx);
 		}
 	}
 }
@@ -223,35 +741,204 @@ bool Manager_ShouldSystemQueueEntity(ECS *ecs, System *system, Entity entity)
 	assert(ecs && system);
 
 	// If we don't want at least one component, we only update the system once.
-	if (system->archetype->size < 1) return false;
-
-	bool should_queue = true;
-	for (size_t idx = 0; idx < system->archetype->size; idx++) {
-		ComponentID id = {entity, system->archetype->components[idx]};
-		if (!Manager_GetComponentByID(ecs, id)) {
-			should_queue = false;
-			break;
+	if (system->sig_words == 0) return false;
+
+	// The entity matches if it has every component the system wants.
+	return bs_subset(system->signature, system->sig_words,
+		Manager_EntitySignature(ecs, entity), ecs->entities.sig_words);
+}
+
+void Manager_UpdateSystem(ECS *ecs, System *system, Entity entity, Component **collection)
+{
+	assert(ecs && system && collection);
+
+	// Systems must have an update function to be registered, and entities don't
+	// get in the queue without having all the required components. Because we
+	// don't insert or delete components during update steps, this is also
+	// thread safe.
+	for (size_t idx = 0; idx < system->archetype->size; idx++)
+		collection[idx] = Manager_GetComponent(ecs, system->types[idx], entity);
+
+	Manager_CallSystem(system, entity, collection);
+}
+
+void Manager_UpdateSystemChunks(ECS *ecs, System *system, Component **collection, size_t stripe, size_t stripes)
+{
+	assert(ecs && system && system->is_chunked && stripes > 0);
+
+	const uint32_t size = system->archetype->size;
+	const hash_t *components = system->archetype->components;
+
+	size_t chunk_idx = 0;
+	for (size_t a_idx = 0; a_idx < system->archetypes.size; a_idx++) {
+		Archetype *arch = *(Archetype **)dyn_get(&system->archetypes, a_idx);
+
+		// Map the system's components to the archetype's columns once, rather
+		// than looking each component up per entity.
+		int columns[size];
+		size_t sizes[size];
+		for (uint32_t comp = 0; comp < size; comp++) {
+			columns[comp] = Archetype_Column(arch, components[comp]);
+			sizes[comp] = arch->types[columns[comp]]->type_size;
+		}
+
+		for (size_t c_idx = 0; c_idx < arch->chunks.size; c_idx++, chunk_idx++) {
+			if (chunk_idx % stripes != stripe) continue;
+
+			Chunk *chunk = CHUNK_GET(arch, c_idx);
+			Entity *entities = CHUNK_ENTITIES(chunk);
+			char *arrays[size];
+			for (uint32_t comp = 0; comp < size; comp++)
+				arrays[comp] = CHUNK_COLUMN(arch, chunk, columns[comp]);
+
+			// Batched systems take the chunk's arrays as they are.
+			if (system->batch_func) {
+				system->batch_func(chunk->count, entities, (Component **)arrays, system->udata);
+				continue;
+			}
+
+			for (uint32_t row = 0; row < chunk->count; row++) {
+				for (uint32_t comp = 0; comp < size; comp++)
+					collection[comp] = arrays[comp] + sizes[comp] * row;
+
+				system->up_func(entities[row], collection, system->udata);
+			}
 		}
 	}
+}
+
+size_t Manager_SystemEntityCount(ECS *ecs, System *system)
+{
+	assert(ecs && system);
+
+	if (!system->is_chunked) return ha_len(system->ent_queue);
+
+	size_t count = 0;
+	DYN_FOR(system->archetypes, 0) {
+		count += (*(Archetype **)dyn_get(&system->archetypes, idx))->count;
+	}
 
-	return should_queue;
+	return count;
 }
 
-void Manager_UpdateSystem(ECS *ecs, System *system, Entity entity)
+void Manager_ArchetypeCreated(ECS *ecs, Archetype *arch)
 {
-	assert(ecs && system && system->archetype->size > 0);
+	assert(ecs && arch);
 
-	const size_t size = system->archetype->size;
-	Component *components[size];
+	HT_ITER(ecs->systems, it) {
+		System *system = *(System **)it.value;
+		if (system->is_chunked
+			&& Archetype_HasTypes(arch, system->archetype->components, system->archetype->size))
+			dyn_append(&system->archetypes, &arch);
+	}
+}
 
-	// Systems must have an update function to be registered, and entities don't
-	// get in the queue without having all the required components.
-	for (size_t idx = 0; idx < size; idx++) {
-		ComponentID id = {entity, system->archetype->components[idx]};
-		components[idx] = Manager_GetComponentByID(ecs, id);
+Arena* Manager_EventArena(ECS *ecs)
+{
+	// Each thread has its own arenas, so allocating from them needs no lock.
+	ThreadData *thread = ECS_CurrentThread();
+	Arena *arenas = thread ? thread->event_arenas : ecs->event_arenas;
+	return &arenas[ecs->event_frame];
+}
+
+bool Manager_PostEvent(ECS *ecs, EventNode **list, Event *event)
+{
+	// Nodes are dispatched in the same event phase as the data sent with them,
+	// so they are allocated and reset alongside it.
+	EventNode *node = arena_alloc(Manager_EventArena(ecs), sizeof(EventNode));
+	if (!node) return false;
+	Event_Copy(&node->event, event);
+
+	// Lists are only ever taken apart as a whole, so pushing can't race with
+	// anything but other pushes.
+	node->next = __atomic_load_n(list, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(list, &node->next, node, true,
+		__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	return true;
+}
+
+EventNode* Manager_TakeEvents(EventNode **list)
+{
+	EventNode *node = __atomic_exchange_n(list, NULL, __ATOMIC_ACQUIRE);
+
+	// The list is newest first, so reverse it to keep the order events were
+	// sent in.
+	EventNode *taken = NULL;
+	while (node) {
+		EventNode *next = node->next;
+		node->next = taken;
+		taken = node;
+		node = next;
 	}
 
-	system->up_func(entity, components, system->udata);
+	return taken;
+}
+
+void Manager_CollectEvents(System *system)
+{
+	EventNode *list = Manager_TakeEvents(&system->posted);
+	while (list) {
+		EventNode *next = list->next;
+		EventQueue_Push(system->ev_queue, &list->event);
+		list = next;
+	}
+}
+
+void Manager_FreeEvents(EventNode *list)
+{
+	for (; list; list = list->next) {
+		if (list->event.should_free) free(list->event.data);
+	}
+}
+
+bool Manager_Subscribe(ECS *ecs, System *system, hash_t event_id)
+{
+	assert(ecs && system);
+
+	dynarray_t *subscribers = ht_get(ecs->subscriptions, event_id);
+	if (subscribers && dyn_find(subscribers, &system) >= 0) return true;
+
+	if (!system->subscriptions.ptr && !dyn_alloc(&system->subscriptions, 4, sizeof(hash_t)))
+		return false;
+
+	if (!subscribers) {
+		subscribers = ht_insert(ecs->subscriptions, event_id, NULL);
+		if (!subscribers) return false;
+
+		if (!dyn_alloc(subscribers, 4, sizeof(System *))) {
+			ht_delete(ecs->subscriptions, event_id);
+			return false;
+		}
+	}
+
+	if (!dyn_append(subscribers, &system)) return false;
+	if (!dyn_append(&system->subscriptions, &event_id)) {
+		Manager_Unsubscribe(ecs, system, event_id);
+		return false;
+	}
+
+	return true;
+}
+
+void Manager_Unsubscribe(ECS *ecs, System *system, hash_t event_id)
+{
+	assert(ecs && system);
+
+	int idx = system->subscriptions.ptr ? dyn_find(&system->subscriptions, &event_id) : -1;
+	if (idx >= 0) dyn_remove(&system->subscriptions, idx, true);
+
+	dynarray_t *subscribers = ht_get(ecs->subscriptions, event_id);
+	if (!subscribers) return;
+
+	// Keep the subscription order, events are routed in that order.
+	idx = dyn_find(subscribers, &system);
+	if (idx >= 0) dyn_remove(subscribers, idx, false);
+
+	if (subscribers->size == 0) {
+		dyn_free(subscribers);
+		ht_delete(ecs->subscriptions, event_id);
+	}
 }
 
 void Manager_SystemEvent(ECS *ecs, System *system, Event *ev)
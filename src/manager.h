@@ -15,67 +15,142 @@
 
 #include "ecs.h"
 #include "command_buffer.h"
+#include "archetype.h"
 #include "macros.h"
 
 typedef struct SystemCollection SystemCollection;
-typedef struct ComponentType ComponentType;
 typedef struct ThreadData ThreadData;
+typedef struct EventNode EventNode;
+
+// A function run on the threads by ECS_RunTasks, once for each task index.
+typedef void (*ecs_task_func)(ECS *ecs, size_t task, void *udata);
+
+/*
+	Per-entity information, stored in the entity registry at the entity's
+	index.
+
+	Entities without any chunked components have a NULL archetype.
+*/
+struct EntityRecord {
+	Archetype *archetype;
+	uint32_t chunk;
+	uint32_t row;
+
+	// The generation of the live entity, or of the next entity to use this
+	// record if it is free.
+	uint32_t generation;
+	// While the record is free, the index of the next free record.
+	uint32_t next_free;
+	bool alive;
+};
+
+#define ENTITY_FREE_END UINT32_MAX
+
+/*
+	A dense array of entity records. Free records form an intrusive LIFO list,
+	so creating and deleting entities is O(1).
+
+	Entity IDs can be reserved ahead of time, from any thread, and the
+	entity created later on. Reserved records beyond `size` haven't been
+	initialized yet; next_index is the first index that hasn't been handed
+	out.
+
+	Each record has a matching component signature: a bitset with the dense
+	type index of every component attached to the entity set. Signatures are
+	stored in a separate array with a stride of sig_words words.
+*/
+typedef struct {
+	EntityRecord *records;
+	uint32_t size;
+	uint32_t capacity;
+	uint32_t count;
+	uint32_t free_head;
+	uint32_t next_index;
+
+	bitset_t *signatures;
+	uint32_t sig_words;
+} EntityRegistry;
 
 struct ECS {
-	hasharray_t *entities;
+	EntityRegistry entities;
 	hashtable_t *systems;
 	// component type registry
 	hashtable_t *cm_types;
+	// ComponentType pointers, indexed by their dense type index.
+	dynarray_t type_list;
+	// chunked component storage, keyed by the hash of the archetype's types.
+	hashtable_t *archetypes;
 
-	// a pre-calculated table containing systems arranged in a way
-	// that respects system dependencies.
+	// the registered systems, in registration order.
 	dynarray_t system_order;
 
-	// a table containing system queuing information.
+	// the update schedule: a ScheduleNode for each system, the edges between
+	// them, and the jobs of every system.
+	dynarray_t schedule;
+	dynarray_t schedule_edges;
 	dynarray_t update_systems;
 	bool update_systems_dirty;
 
+	// Set for the duration of ECS_Update; some calls are not allowed meanwhile.
 	bool is_updating;
-	hasharray_t *buffers;
+	// The command buffers created on the main thread.
+	dynarray_t buffers;
+
+	// event id -> dynarray_t of the subscribed System pointers.
+	hashtable_t *subscriptions;
+	// Published events owning their data, which is freed once the events have
+	// been dispatched. Only accessed atomically.
+	EventNode *published;
+	// Event data is allocated from the arenas at index event_frame. Each event
+	// phase flips the index, and resets the arenas it was using once all of
+	// their events have been dispatched.
+	Arena event_arenas[2];
+	uint32_t event_frame;
 
 	size_t num_threads;
-	size_t ready_threads;
 	ThreadData **threads;
 
+	// Job scheduling state, see thread.c. The counters are only accessed
+	// atomically.
+	size_t next_thread;
+	size_t queued_jobs;
+	size_t nodes_left;
+	size_t sleeping_threads;
+	bool stop_threads;
+	pthread_mutex_t job_lock;
+	// Schedule nodes which have to run on the main thread, guarded by the
+	// job lock.
+	dynarray_t main_queue;
+	// Signalled when jobs are queued, or the threads should stop.
+	pthread_cond_t job_cond;
+	// Signalled when the main thread has work, the schedule is done, or a
+	// thread goes to sleep.
+	pthread_cond_t done_cond;
+
+	// The function run by ECS_RunTasks, and the number of its tasks left.
+	ecs_task_func task_func;
+	void *task_data;
+	size_t tasks_left;
+
 	pthread_mutex_t global_lock;
-	pthread_cond_t ready_cond;
 
 	ECS_AllocInfo alloc_info;
 };
 
-struct ThreadData {
-    ECS *ecs;
-	pthread_t thread;
-	bool running;
-
-	bool ready;
-    pthread_mutex_t update_mutex;
-	pthread_cond_t update_cond;
-
-	size_t collection_size;
-    Component **collection;
-
-	System *system;
-	// The range of entities to update.
-	struct {
-		hash_t start;
-		hash_t end;
-	} range;
-};
-
-void ThreadData_delete(ThreadData *data);
-
 struct EntityArchetype {
 	const char *name;
 	hash_t name_hash;
 
 	uint32_t size;
 	hash_t* components;
+	// Whether systems using this archetype only read each component.
+	bool *read_only;
+};
+
+// An event sent to a system with ECS_SystemQueueEvent.
+struct EventNode {
+	EventNode *next;
+	Event event;
 };
 
 struct System {
@@ -85,13 +160,37 @@ struct System {
 
     system_update_func up_func;
     system_event_func ev_func;
+    // If set, replaces up_func.
+    system_batch_func batch_func;
 
 	bool is_thread_safe;
 
 	EntityArchetype *archetype;
 	hashset_t *dependencies;
 
+	// The type indexes of the archetype's components. An entity matches the
+	// system if this is a subset of the entity's signature.
+	bitset_t *signature;
+	uint32_t sig_words;
+	// The components the system only reads and the ones it writes to, split
+	// out of the signature so the scheduler can test for conflicts. Allocated
+	// together with the signature.
+	bitset_t *reads;
+	bitset_t *writes;
+	// The archetype's component types, so updates don't look them up for
+	// every entity.
+	ComponentType **types;
+
+	// If all components the system operates on are chunked, the system
+	// iterates over the chunks of these Archetypes instead of its ent_queue.
+	bool is_chunked;
+	dynarray_t archetypes;
+
 	EventQueue *ev_queue;
+	// Events sent from any thread, newest first. Only accessed atomically.
+	EventNode *posted;
+	// The event ids the system is subscribed to.
+	dynarray_t subscriptions;
 	hasharray_t *ent_queue;
 };
 
@@ -101,30 +200,124 @@ struct ComponentType {
 	component_delete_func dl_func;
 	size_t type_size;
 	hash_t type_hash;
+	// Dense index of the type, used for component signatures.
+	uint32_t type_idx;
+	ComponentStorage storage;
+	// The systems operating on this component type, so adding or removing a
+	// component only re-evaluates the systems it can affect.
+	dynarray_t systems;
+	// Unused for ComponentStorageChunked and ComponentStorageSparse types.
 	hashtable_t *components;
+	// Only used for ComponentStorageSparse types.
+	sparseset_t *sparse;
 };
 
 typedef enum {
-	SYSTEM_UPDATE_BARRIER = 0,
-	SYSTEM_UPDATE_ONTHREAD,
-	SYSTEM_UPDATE_QUEUED
-	// TODO: more items needed?
+	SYSTEM_UPDATE_ONTHREAD = 0,
+	SYSTEM_UPDATE_QUEUED,
+	SYSTEM_TASK
 } SystemQueueType;
 
+/*
+	A job updating the entities of a system in the range [start, end).
+
+	For chunked systems, start and end are instead used to stripe the chunks
+	of the system across threads: the item updates every `end`th chunk,
+	starting with chunk number `start`.
+
+	SYSTEM_TASK jobs don't belong to a system, and run task number `start` of
+	the current ECS_RunTasks call instead.
+*/
 typedef struct {
 	SystemQueueType type;
 	hash_t start;
 	hash_t end;
 	System *system;
+	// The index of the system's ScheduleNode.
+	uint32_t node;
 } SystemQueueItem;
 
+/*
+	A system in the update schedule. Its jobs are queued as soon as all of the
+	systems it depends on have finished updating, either because of its
+	AfterSystems or because they access the same components.
+*/
+typedef struct {
+	System *system;
+	// The system's job slots in ECS::update_systems, and how many of them
+	// are used by the current update.
+	uint32_t first_job;
+	uint32_t max_jobs;
+	uint32_t num_jobs;
+	// The systems waiting on this one, as node indexes in ECS::schedule_edges.
+	uint32_t first_edge;
+	uint32_t num_edges;
+	// The number of systems this one waits on.
+	uint32_t num_deps;
+
+	// Only accessed atomically while updating.
+	uint32_t deps_left;
+	uint32_t jobs_left;
+} ScheduleNode;
+
+/*
+	A double-ended queue of jobs, stored as a ring buffer with a power of two
+	capacity. Its thread pops jobs from the back, while idle threads steal
+	from the front.
+*/
+typedef struct {
+	pthread_mutex_t lock;
+	SystemQueueItem *jobs;
+	size_t capacity;
+	size_t head;
+	size_t tail;
+} JobDeque;
+
+struct ThreadData {
+	ECS *ecs;
+	pthread_t thread;
+	// The index of the thread in ECS::threads.
+	size_t index;
+
+	JobDeque jobs;
+	// The command buffers created on this thread.
+	dynarray_t buffers;
+	// The data of the events sent from this thread, see ECS::event_frame.
+	Arena event_arenas[2];
+
+	size_t collection_size;
+	Component **collection;
+};
+
+void ThreadData_delete(ThreadData *data);
+
 /* -------------------------------------------------------------------------- */
 
 void ECS_Error(ECS *ecs, const char *msg);
 
 void ECS_ArrangeSystems(ECS *ecs);
-
-ThreadData* ECS_NewThread(ECS *ecs);
+// Split the update of a ready system into jobs.
+void ECS_SplitSystemJobs(ECS *ecs, ScheduleNode *node);
+// Play back and delete all command buffers. Must not be called while
+// systems are updating.
+void ECS_ResolveCommandBuffers(ECS *ecs);
+
+ThreadData* ECS_NewThread(ECS *ecs, size_t index);
+// Returns the thread the caller is running on, or NULL on the main thread.
+ThreadData* ECS_CurrentThread(void);
+// Stop and join all threads. They must not have any pending jobs.
+void ECS_StopThreads(ECS *ecs);
+
+// Queue a job on one of the threads.
+void ECS_PushJob(ECS *ecs, SystemQueueItem *item);
+// Run the update schedule until every system has been updated.
+void ECS_RunSchedule(ECS *ecs);
+// Update the range of a system described by a job. `collection` must have room
+// for a pointer to each component in the system's archetype.
+void ECS_RunJob(ECS *ecs, SystemQueueItem *item, Component **collection);
+// Run `count` tasks on the threads and wait for all of them to finish. Must
+// not be called while systems are updating.
+void ECS_RunTasks(ECS *ecs, size_t count, ecs_task_func func, void *udata);
 
 /* -------------------------------------------------------------------------- */
 
@@ -133,29 +326,113 @@ ComponentType* Manager_GetComponentType(ECS *ecs, hash_t type);
 bool Manager_RegisterComponentType(ECS *ecs, ComponentType *type);
 
 Component* Manager_CreateComponent(ECS *ecs, ComponentType *type, hash_t id);
+// Create a component holding a copy of `data` instead of running its creation
+// function. `data` may be NULL.
+Component* Manager_CreateComponentFrom(ECS *ecs, ComponentType *type, hash_t id, const void *data);
+// Create or delete a component that isn't chunked in its type's storage only,
+// leaving the entity's signature and the system collections alone. Only the
+// type's own storage is touched, so different types can be changed at once.
+Component* Manager_StoreComponent(ComponentType *type, hash_t id, const void *data);
+void Manager_UnstoreComponent(ComponentType *type, hash_t id);
 Component* Manager_GetComponent(ECS *ecs, ComponentType *type, hash_t id);
 // If a component exists under an entity's ID, it is automatically associated
 // with that entity. No backsies.
 Component* Manager_GetComponentByID(ECS *ecs, ComponentID id);
 void Manager_DeleteComponent(ECS *ecs, ComponentType *type, hash_t id);
-
+// Remove and then add several components on an entity. Chunked components
+// are moved into their final archetype at once, and the entity's system
+// collections are only updated after all components have been changed.
+// `add_data` may hold the initial contents of each added component, which
+// replace the creation function (or the existing contents). It may be NULL.
+// Returns false if any of the components could not be created.
+bool Manager_ApplyComponents(ECS *ecs, Entity entity, ComponentType **add, const void **add_data,
+	uint32_t num_add, ComponentType **remove, uint32_t num_remove);
+
+bool Manager_InitEntities(ECS *ecs, size_t capacity);
+// Grow the entity records and the systems' entity queues to hold `count`
+// entities, and a component type's storage to hold `count` components.
+bool Manager_ReserveEntities(ECS *ecs, size_t count);
+bool Manager_ReserveComponents(ECS *ecs, ComponentType *type, size_t count);
 Entity Manager_CreateEntity(ECS *ecs);
+// Reserve an entity ID without creating the entity. Thread safe while
+// systems are updating, as long as no entities are deleted meanwhile.
+Entity Manager_ReserveEntity(ECS *ecs);
+// Create the entity for a reserved ID.
+bool Manager_CreateReservedEntity(ECS *ecs, Entity entity);
+// Give back a reserved ID without creating the entity.
+void Manager_ReleaseEntity(ECS *ecs, Entity entity);
 void Manager_DeleteEntity(ECS *ecs, Entity entity);
 
+// Returns the record of a live entity, or NULL if the handle is stale.
+static inline EntityRecord* Manager_GetEntity(ECS *ecs, Entity entity)
+{
+	EntityRegistry *reg = &ecs->entities;
+	hash_t idx = ENTITY_INDEX(entity);
+	if (idx >= reg->size) return NULL;
+
+	EntityRecord *rec = &reg->records[idx];
+	return rec->alive && rec->generation == ENTITY_GENERATION(entity) ? rec : NULL;
+}
+
+// Returns the component signature of an entity. Does not check the handle.
+static inline bitset_t* Manager_EntitySignature(ECS *ecs, Entity entity)
+{
+	return &ecs->entities.signatures[ENTITY_INDEX(entity) * ecs->entities.sig_words];
+}
+
 bool Manager_RegisterSystem(ECS *ecs, System *info);
 System* Manager_GetSystem(ECS *ecs, const char *name);
 void Manager_UnregisterSystem(ECS *ecs, System *system);
 
-void Manager_UpdateCollections(ECS *ecs, Entity entity);
+// Re-evaluate the system queues an entity belongs to after a component of the
+// passed type was added to or removed from it.
+void Manager_UpdateCollections(ECS *ecs, Entity entity, ComponentType *type);
 bool Manager_ShouldSystemQueueEntity(ECS *ecs, System *sys, Entity entity);
-void Manager_UpdateSystem(ECS *ecs, System *info, Entity entity);
+// Update a system for a single entity. `collection` must have room for a
+// pointer to each component in the system's archetype.
+void Manager_UpdateSystem(ECS *ecs, System *info, Entity entity, Component **collection);
+
+// Call the update function of a system for a single entity.
+static inline void Manager_CallSystem(System *system, Entity entity, Component **components)
+{
+	if (system->batch_func)
+		system->batch_func(1, &entity, components, system->udata);
+	else
+		system->up_func(entity, components, system->udata);
+}
+
+// Update a chunked system. `collection` must have room for a pointer to each
+// component in the system's archetype.
+void Manager_UpdateSystemChunks(ECS *ecs, System *system, Component **collection, size_t stripe, size_t stripes);
+size_t Manager_SystemEntityCount(ECS *ecs, System *system);
+void Manager_ArchetypeCreated(ECS *ecs, Archetype *arch);
+// The event arena of the calling thread for the current event phase.
+Arena* Manager_EventArena(ECS *ecs);
+// Push an event onto a list of EventNodes, from any thread and without
+// locking. The node is allocated from the calling thread's event arena.
+// Returns false if there is no memory for the node.
+bool Manager_PostEvent(ECS *ecs, EventNode **list, Event *event);
+// Take all events from a list, oldest first. Only one thread at a time may
+// take events from a given list.
+EventNode* Manager_TakeEvents(EventNode **list);
+// Free the data owned by a list of taken events. The nodes themselves are
+// released with the event arenas.
+void Manager_FreeEvents(EventNode *list);
+// Move the events sent with ECS_SystemQueueEvent into the system's queue.
+void Manager_CollectEvents(System *system);
+// Add or remove a system from the subscribers of an event id. Not thread
+// safe.
+bool Manager_Subscribe(ECS *ecs, System *system, hash_t event_id);
+void Manager_Unsubscribe(ECS *ecs, System *system, hash_t event_id);
 void Manager_SystemEvent(ECS *ecs, System *info, Event *event);
 
 /* -------------------------------------------------------------------------- */
 
 // Converts a NULL-terminated list of strings into an explicit-size list of
 // hash IDs. The pointer to the generated array is stored in dst.
-int string_arr_to_type(hash_t **dst, const char **src);
+// If read_only is not NULL, strings declared with ComponentRead() are
+// flagged in a second array stored in read_only.
+int string_arr_to_type(hash_t **dst, bool **read_only, const char **src);
 
 /* -------------------------------------------------------------------------- */
 
@@ -169,10 +446,7 @@ int string_arr_to_type(hash_t **dst, const char **src);
 #define ECS_UNLOCK(ecs) pthread_mutex_unlock(&ecs->global_lock)
 #define ECS_ATOMIC(ecs, op) ECS_LOCK(ecs); op; ECS_UNLOCK(ecs)
 
-#define THREAD_LOCK(data) pthread_mutex_lock(&data->update_mutex)
-#define THREAD_UNLOCK(data) pthread_mutex_unlock(&data->update_mutex)
-
-#define READY_THREAD(ecs) ECS_ATOMIC(ecs, (ecs)->ready_threads++)
-#define UNREADY_THREAD(ecs) ECS_ATOMIC(ecs, (ecs)->ready_threads--)
+#define JOB_LOCK(ecs) pthread_mutex_lock(&(ecs)->job_lock)
+#define JOB_UNLOCK(ecs) pthread_mutex_unlock(&(ecs)->job_lock)
 
 #endif // ECS_MANAGER_H
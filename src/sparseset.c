@@ -0,0 +1,191 @@
+// sparseset.c
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sparseset.h"
+
+/*
+    The sparse table is split into pages of PAGE_SIZE slots, which are only
+    allocated when a key inside them is inserted. Each slot stores the dense
+    index of its key plus one, so zero-filled pages are empty.
+*/
+#define PAGE_BITS 12
+#define PAGE_SIZE (1 << PAGE_BITS)
+#define PAGE_MASK (PAGE_SIZE - 1)
+
+struct sparseset_t {
+    size_t count;
+    size_t capacity;
+    size_t entry_size;
+
+    hash_t *keys;
+    char *data;
+
+    size_t num_pages;
+    uint32_t **pages;
+};
+
+static inline uint32_t* get_slot(sparseset_t *ss, hash_t key)
+{
+    size_t page = key >> PAGE_BITS;
+    if (page >= ss->num_pages || !ss->pages[page]) return NULL;
+
+    return &ss->pages[page][key & PAGE_MASK];
+}
+
+// Get the sparse slot for a key, allocating its page if necessary.
+static uint32_t* make_slot(sparseset_t *ss, hash_t key)
+{
+    size_t page = key >> PAGE_BITS;
+    if (page >= ss->num_pages) {
+        size_t num_pages = ss->num_pages ? ss->num_pages : 1;
+        while (num_pages <= page) num_pages *= 2;
+
+        uint32_t **ptr = realloc(ss->pages, sizeof(uint32_t *) * num_pages);
+        if (!ptr) return NULL;
+
+        memset(ptr + ss->num_pages, 0, sizeof(uint32_t *) * (num_pages - ss->num_pages));
+        ss->pages = ptr;
+        ss->num_pages = num_pages;
+    }
+
+    if (!ss->pages[page]) {
+        ss->pages[page] = calloc(PAGE_SIZE, sizeof(uint32_t));
+        if (!ss->pages[page]) return NULL;
+    }
+
+    return &ss->pages[page][key & PAGE_MASK];
+}
+
+static bool grow(sparseset_t *ss, size_t capacity)
+{
+
+    hash_t *keys = realloc(ss->keys, sizeof(hash_t) * capacity);
+    if (!keys) return false;
+    ss->keys = keys;
+
+    char *data = realloc(ss->data, ss->entry_size * capacity);
+    if (!data) return false;
+    ss->data = data;
+
+    ss->capacity = capacity;
+    return true;
+}
+
+sparseset_t* ss_alloc(size_t num_entries, size_t entry_size)
+{
+    sparseset_t *ss = malloc(sizeof(sparseset_t));
+    if (!ss) return NULL;
+
+    // Empty entries still need distinct addresses.
+    if (entry_size == 0) entry_size = 1;
+    if (num_entries == 0) num_entries = 16;
+
+    ss->count = 0;
+    ss->capacity = num_entries;
+    ss->entry_size = entry_size;
+    ss->keys = malloc(sizeof(hash_t) * num_entries);
+    ss->data = malloc(entry_size * num_entries);
+    ss->num_pages = 0;
+    ss->pages = NULL;
+
+    if (!ss->keys || !ss->data) {
+        ss_free(ss);
+        return NULL;
+    }
+
+    return ss;
+}
+
+void ss_free(sparseset_t *ss)
+{
+    assert(ss);
+
+    for (size_t idx = 0; idx < ss->num_pages; idx++) free(ss->pages[idx]);
+    free(ss->pages);
+    free(ss->keys);
+    free(ss->data);
+    free(ss);
+}
+
+void* ss_insert(sparseset_t *ss, hash_t key, void *data)
+{
+    assert(ss);
+
+    uint32_t *slot = make_slot(ss, key);
+    if (!slot) return NULL;
+
+    // Append the entry to the dense array if it isn't already present.
+    if (*slot == 0) {
+        if (ss->count == ss->capacity && !grow(ss, ss->capacity * 2)) return NULL;
+
+        ss->keys[ss->count] = key;
+        *slot = ++ss->count;
+    }
+
+    void *entry = ss->data + (*slot - 1) * ss->entry_size;
+    if (data)
+        memcpy(entry, data, ss->entry_size);
+    else
+        memset(entry, 0, ss->entry_size);
+
+    return entry;
+}
+
+bool ss_reserve(sparseset_t *ss, size_t capacity)
+{
+    assert(ss);
+
+    return capacity <= ss->capacity || grow(ss, capacity);
+}
+
+void* ss_get(sparseset_t *ss, hash_t key)
+{
+    uint32_t *slot = get_slot(ss, key);
+    if (!slot || *slot == 0) return NULL;
+
+    return ss->data + (*slot - 1) * ss->entry_size;
+}
+
+void ss_delete(sparseset_t *ss, hash_t key)
+{
+    assert(ss);
+
+    uint32_t *slot = get_slot(ss, key);
+    if (!slot || *slot == 0) return;
+
+    // Move the last entry into the hole to keep the dense array packed.
+    size_t idx = *slot - 1;
+    size_t last = --ss->count;
+    if (idx != last) {
+        hash_t moved = ss->keys[last];
+        ss->keys[idx] = moved;
+        memcpy(ss->data + idx * ss->entry_size, ss->data + last * ss->entry_size, ss->entry_size);
+        *get_slot(ss, moved) = idx + 1;
+    }
+
+    *slot = 0;
+}
+
+size_t ss_len(sparseset_t *ss)
+{
+    return ss->count;
+}
+
+hash_t* ss_keys(sparseset_t *ss)
+{
+    return ss->keys;
+}
+
+void* ss_data(sparseset_t *ss)
+{
+    return ss->data;
+}
+
+size_t ss_entry_size(sparseset_t *ss)
+{
+    return ss->entry_size;
+}
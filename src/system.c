@@ -3,7 +3,7 @@
 
 bool ECS_SystemRegister(ECS *ecs, const SystemRegistryInfo *reg, void *data)
 {
-    assert(ecs && reg->name && reg->update);
+    assert(ecs && reg->name && (reg->update || reg->batch));
 
     const char *name = reg->name;
     const SystemUpdateInfo *update_info = reg->update_info;
@@ -19,6 +19,7 @@ bool ECS_SystemRegister(ECS *ecs, const SystemRegistryInfo *reg, void *data)
     info.udata = data;
 
     info.up_func = reg->update;
+    info.batch_func = reg->batch;
     info.ev_func = reg->event;
 
     info.archetype = reg->archetype;
@@ -28,6 +29,7 @@ bool ECS_SystemRegister(ECS *ecs, const SystemRegistryInfo *reg, void *data)
         && !update_info->CreatesOrDeletesEntities;
 
     // If we have dependencies, create a hash set to store them in.
+    info.dependencies = NULL;
     if (update_info->AfterSystems) {
         info.dependencies = hs_alloc(16);
         for (size_t idx = 0; update_info->AfterSystems[idx] != NULL; idx++) {
@@ -36,9 +38,17 @@ bool ECS_SystemRegister(ECS *ecs, const SystemRegistryInfo *reg, void *data)
     }
 
     info.ev_queue = EventQueue_New();
+    info.posted = NULL;
+    info.subscriptions = (dynarray_t){0};
     info.ent_queue = NULL;
 
-    return Manager_RegisterSystem(ecs, &info);
+    if (!Manager_RegisterSystem(ecs, &info)) {
+        EventQueue_Free(info.ev_queue);
+        if (info.dependencies) hs_free(info.dependencies);
+        return false;
+    }
+
+    return true;
 }
 
 System* ECS_SystemGet(ECS *ecs, const char *name)
@@ -47,11 +57,90 @@ System* ECS_SystemGet(ECS *ecs, const char *name)
     return Manager_GetSystem(ecs, name);
 }
 
+bool ECS_SystemQueueEvent(ECS *ecs, const char *name, Event *event)
+{
+    assert(ecs && ecs->systems && name && event);
+
+    System *system = Manager_GetSystem(ecs, name);
+    if (!system) return false;
+
+    return Manager_PostEvent(ecs, &system->posted, event);
+}
+
+EventData* ECS_EventSetData(ECS *ecs, Event *event, const void *data, size_t size)
+{
+    assert(ecs && event);
+
+    EventData *ptr;
+    if (size <= EVENT_INLINE_SIZE) {
+        ptr = event->payload;
+    }
+    else {
+        ptr = arena_alloc(Manager_EventArena(ecs), size);
+        ERR_RET_NULL(ptr, "Error allocating event data: out of memory.\n");
+    }
+
+    if (data)
+        memcpy(ptr, data, size);
+    else
+        memset(ptr, 0, size);
+
+    event->data = ptr;
+    event->should_free = false;
+    event->is_inline = size <= EVENT_INLINE_SIZE;
+    return ptr;
+}
+
+bool ECS_SystemSubscribe(ECS *ecs, const char *name, hash_t event_id)
+{
+    assert(ecs && ecs->systems && name && !ecs->is_updating);
+
+    System *system = Manager_GetSystem(ecs, name);
+    if (!system) return false;
+
+    return Manager_Subscribe(ecs, system, event_id);
+}
+
+void ECS_SystemUnsubscribe(ECS *ecs, const char *name, hash_t event_id)
+{
+    assert(ecs && ecs->systems && name && !ecs->is_updating);
+
+    System *system = Manager_GetSystem(ecs, name);
+    if (system) Manager_Unsubscribe(ecs, system, event_id);
+}
+
+size_t ECS_PublishEvent(ECS *ecs, Event *event)
+{
+    assert(ecs && event);
+
+    dynarray_t *subscribers = ht_get(ecs->subscriptions, event->id);
+    size_t sent = 0;
+
+    // The subscribers share the event's data, so none of them frees it.
+    Event copy;
+    Event_Copy(&copy, event);
+    copy.should_free = false;
+    if (subscribers) DYN_FOR(*subscribers, 0) {
+        System *system = *(System **)dyn_get(subscribers, idx);
+        sent += Manager_PostEvent(ecs, &system->posted, &copy);
+    }
+
+    // Instead, it is freed once they have all been dispatched.
+    if (event->should_free) {
+        if (sent == 0)
+            free(event->data);
+        else if (!Manager_PostEvent(ecs, &ecs->published, event))
+            ECS_ERROR(ecs, "Error publishing event %08x: out of memory, leaking its data.", event->id);
+    }
+
+    return sent;
+}
+
 void ECS_SystemUnregister(ECS *ecs, const char *name)
 {
     assert(ecs && ecs->systems && name);
 
-    System *info = ht_get(ecs->systems, hash_string(name));
+    System *info = Manager_GetSystem(ecs, name);
     if (!info) return;
     Manager_UnregisterSystem(ecs, info);
 }
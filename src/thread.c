@@ -3,113 +3,417 @@
 #include "manager.h"
 #include "profile.h"
 
-#define THREAD_WAIT(data) pthread_cond_wait(&data->update_cond, &data->update_mutex)
+/*
+    Each thread owns a deque of jobs, which the main thread fills in a
+    round-robin fashion. A thread pops jobs from the back of its own deque,
+    and once it runs dry, steals jobs from the front of the other threads'
+    deques. Only threads without any work to find touch the shared job lock.
+
+    ECS::queued_jobs counts the jobs waiting in a deque.
+
+    Jobs are queued by following the update schedule: once the last job of a
+    system finishes, the systems waiting on it are readied, and once all of
+    their dependencies are done, their jobs are pushed by whichever thread
+    readied them. Systems which are not thread safe are handed to the main
+    thread instead.
+*/
+
+#define JOB_DEQUE_SIZE 16
 
 void* UpdateThread_main(void *arg);
 
-ThreadData* ECS_NewThread(ECS *ecs)
+// The thread the calling code is running on, or NULL on the main thread.
+static __thread ThreadData *current_thread = NULL;
+
+static bool JobDeque_init(JobDeque *deque)
+{
+    deque->jobs = malloc(sizeof(SystemQueueItem) * JOB_DEQUE_SIZE);
+    deque->capacity = JOB_DEQUE_SIZE;
+    deque->head = deque->tail = 0;
+
+    if (!deque->jobs) return false;
+    if (pthread_mutex_init(&deque->lock, NULL) != 0) {
+        free(deque->jobs);
+        return false;
+    }
+
+    return true;
+}
+
+static bool JobDeque_push(JobDeque *deque, SystemQueueItem *item)
+{
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->tail - deque->head == deque->capacity) {
+        // Unwrap the ring into the new buffer.
+        size_t capacity = deque->capacity * 2;
+        SystemQueueItem *jobs = malloc(sizeof(SystemQueueItem) * capacity);
+        if (!jobs) {
+            pthread_mutex_unlock(&deque->lock);
+            return false;
+        }
+
+        for (size_t idx = deque->head; idx != deque->tail; idx++)
+            jobs[idx - deque->head] = deque->jobs[idx & (deque->capacity - 1)];
+
+        free(deque->jobs);
+        deque->jobs = jobs;
+        deque->tail -= deque->head;
+        deque->head = 0;
+        deque->capacity = capacity;
+    }
+
+    deque->jobs[deque->tail++ & (deque->capacity - 1)] = *item;
+
+    pthread_mutex_unlock(&deque->lock);
+    return true;
+}
+
+// Take a job from the back (pop) or the front (steal) of the deque.
+static bool JobDeque_take(JobDeque *deque, SystemQueueItem *item, bool steal)
+{
+    pthread_mutex_lock(&deque->lock);
+
+    bool found = deque->head != deque->tail;
+    if (found) {
+        size_t idx = steal ? deque->head++ : --deque->tail;
+        *item = deque->jobs[idx & (deque->capacity - 1)];
+    }
+
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// Find a job, starting with the deque of the thread at `start`.
+static bool take_job(ECS *ecs, size_t start, SystemQueueItem *item)
+{
+    size_t num_threads = ecs->num_threads;
+    for (size_t idx = 0; idx < num_threads; idx++) {
+        if (__atomic_load_n(&ecs->queued_jobs, __ATOMIC_ACQUIRE) == 0) return false;
+
+        ThreadData *data = ecs->threads[(start + idx) % num_threads];
+        if (JobDeque_take(&data->jobs, item, idx > 0)) {
+            __atomic_sub_fetch(&ecs->queued_jobs, 1, __ATOMIC_ACQ_REL);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void ready_node(ECS *ecs, uint32_t node_idx)
+{
+    ScheduleNode *node = dyn_get(&ecs->schedule, node_idx);
+    SystemQueueItem *jobs = dyn_get(&ecs->update_systems, node->first_job);
+    ECS_SplitSystemJobs(ecs, node);
+
+    if (ecs->num_threads == 0 || jobs[0].type == SYSTEM_UPDATE_ONTHREAD) {
+        JOB_LOCK(ecs);
+        dyn_append(&ecs->main_queue, &node_idx);
+        pthread_cond_broadcast(&ecs->done_cond);
+        JOB_UNLOCK(ecs);
+        return;
+    }
+
+    for (uint32_t idx = 0; idx < node->num_jobs; idx++)
+        ECS_PushJob(ecs, &jobs[idx]);
+}
+
+static void finish_job(ECS *ecs, SystemQueueItem *item)
+{
+    ScheduleNode *node = dyn_get(&ecs->schedule, item->node);
+    if (__atomic_sub_fetch(&node->jobs_left, 1, __ATOMIC_ACQ_REL) > 0) return;
+
+    // That was the system's last job, so let the systems waiting on it go.
+    uint32_t *edges = dyn_get(&ecs->schedule_edges, node->first_edge);
+    for (uint32_t idx = 0; idx < node->num_edges; idx++) {
+        ScheduleNode *next = dyn_get(&ecs->schedule, edges[idx]);
+        if (__atomic_sub_fetch(&next->deps_left, 1, __ATOMIC_ACQ_REL) == 0)
+            ready_node(ecs, edges[idx]);
+    }
+
+    if (__atomic_sub_fetch(&ecs->nodes_left, 1, __ATOMIC_ACQ_REL) == 0) {
+        JOB_LOCK(ecs);
+        pthread_cond_broadcast(&ecs->done_cond);
+        JOB_UNLOCK(ecs);
+    }
+}
+
+static void run_task(ECS *ecs, SystemQueueItem *item)
+{
+    ecs->task_func(ecs, item->start, ecs->task_data);
+    if (__atomic_sub_fetch(&ecs->tasks_left, 1, __ATOMIC_ACQ_REL) > 0) return;
+
+    JOB_LOCK(ecs);
+    pthread_cond_broadcast(&ecs->done_cond);
+    JOB_UNLOCK(ecs);
+}
+
+// The number of components a system's jobs collect for each entity.
+static size_t collection_size(System *system)
+{
+    return system->archetype ? system->archetype->size : 0;
+}
+
+static void run_job(ECS *ecs, SystemQueueItem *item)
+{
+    if (item->type == SYSTEM_TASK) {
+        run_task(ecs, item);
+        return;
+    }
+
+    Component *collection[collection_size(item->system) + 1];
+    ECS_RunJob(ecs, item, collection);
+    finish_job(ecs, item);
+}
+
+/* -------------------------------------------------------------------------- */
+
+ThreadData* ECS_NewThread(ECS *ecs, size_t index)
 {
     ThreadData *data = malloc(sizeof(ThreadData));
     if (!data) return NULL;
 
     data->ecs = ecs;
-    data->running = false;
-    data->ready = false;
-    pthread_mutex_init(&data->update_mutex, NULL);
-    pthread_cond_init(&data->update_cond, NULL);
-    pthread_create(&data->thread, NULL, &UpdateThread_main, data);
+    data->index = index;
+    data->collection_size = 32;
+    data->collection = calloc(data->collection_size, sizeof(Component *));
+    arena_init(&data->event_arenas[0], 0);
+    arena_init(&data->event_arenas[1], 0);
+
+    if (!data->collection || !dyn_alloc(&data->buffers, 4, sizeof(CommandBuffer *))
+        || !JobDeque_init(&data->jobs)) {
+        free(data->collection);
+        free(data->buffers.ptr);
+        free(data);
+        return NULL;
+    }
+
+    if (pthread_create(&data->thread, NULL, &UpdateThread_main, data) != 0) {
+        ThreadData_delete(data);
+        free(data);
+        return NULL;
+    }
 
     return data;
 }
 
-bool UpdateThread_start(ThreadData *data)
+ThreadData* ECS_CurrentThread(void)
 {
-    assert(data && data->ecs);
+    return current_thread;
+}
 
-    data->collection_size = 32;
-    data->collection = calloc(data->collection_size, sizeof(Component *));
+void ECS_StopThreads(ECS *ecs)
+{
+    JOB_LOCK(ecs);
+    ecs->stop_threads = true;
+    pthread_cond_broadcast(&ecs->job_cond);
+    JOB_UNLOCK(ecs);
 
-    if (!data->collection) {
-        return false;
+    for (size_t idx = 0; idx < ecs->num_threads; idx++)
+        pthread_join(ecs->threads[idx]->thread, NULL);
+}
+
+void ECS_PushJob(ECS *ecs, SystemQueueItem *item)
+{
+    assert(ecs->num_threads > 0);
+
+    // Threads keep the jobs they queue, the main thread spreads them out.
+    ThreadData *data = current_thread;
+    if (!data) {
+        size_t idx = __atomic_fetch_add(&ecs->next_thread, 1, __ATOMIC_RELAXED);
+        data = ecs->threads[idx % ecs->num_threads];
     }
 
-    return true;
+    __atomic_add_fetch(&ecs->queued_jobs, 1, __ATOMIC_ACQ_REL);
+    if (!JobDeque_push(&data->jobs, item)) {
+        // Can't queue it, so do the work here.
+        __atomic_sub_fetch(&ecs->queued_jobs, 1, __ATOMIC_ACQ_REL);
+        run_job(ecs, item);
+        return;
+    }
+
+    JOB_LOCK(ecs);
+    if (ecs->sleeping_threads > 0) pthread_cond_signal(&ecs->job_cond);
+    JOB_UNLOCK(ecs);
 }
 
-void UpdateThread_update(ThreadData *data, System *system, Entity entity)
+void ECS_RunSchedule(ECS *ecs)
 {
-    size_t collection_size = system->archetype->size;
-    // Resize the buffer if it needs it.
-    if (data->collection_size < collection_size) {
-        Component **ptr = calloc(collection_size, sizeof(Component *));
-        if (!ptr) {
-            ECS_Error(data->ecs, "Failed to resize thread component buffer!");
-            data->running = false;
-            return;
+    if (ecs->schedule.size == 0) return;
+
+    // Reset the counters before anything gets queued. The job counts are set
+    // as each system is readied.
+    DYN_FOR(ecs->schedule, 0) {
+        ScheduleNode *node = dyn_get(&ecs->schedule, idx);
+        node->deps_left = node->num_deps;
+    }
+    __atomic_store_n(&ecs->nodes_left, ecs->schedule.size, __ATOMIC_RELEASE);
+
+    DYN_FOR(ecs->schedule, 0) {
+        ScheduleNode *node = dyn_get(&ecs->schedule, idx);
+        if (node->num_deps == 0) ready_node(ecs, idx);
+    }
+
+    while (true) {
+        // Rather than idling, the main thread works through the queued jobs too.
+        SystemQueueItem item;
+        if (take_job(ecs, 0, &item)) {
+            run_job(ecs, &item);
+            continue;
+        }
+
+        JOB_LOCK(ecs);
+        while (__atomic_load_n(&ecs->nodes_left, __ATOMIC_ACQUIRE) > 0
+            && ecs->main_queue.size == 0
+            && __atomic_load_n(&ecs->queued_jobs, __ATOMIC_ACQUIRE) == 0)
+            pthread_cond_wait(&ecs->done_cond, &ecs->job_lock);
+
+        if (__atomic_load_n(&ecs->nodes_left, __ATOMIC_ACQUIRE) == 0) {
+            JOB_UNLOCK(ecs);
+            break;
+        }
+
+        uint32_t node_idx = 0;
+        bool has_node = ecs->main_queue.size > 0;
+        if (has_node) {
+            node_idx = *(uint32_t *)dyn_get(&ecs->main_queue, -1);
+            dyn_delete(&ecs->main_queue, -1);
         }
+        JOB_UNLOCK(ecs);
 
-        data->collection_size = collection_size;
-        data->collection = ptr;
+        if (has_node) {
+            ScheduleNode *node = dyn_get(&ecs->schedule, node_idx);
+            SystemQueueItem *jobs = dyn_get(&ecs->update_systems, node->first_job);
+            for (uint32_t idx = 0; idx < node->num_jobs; idx++)
+                run_job(ecs, &jobs[idx]);
+        }
     }
+}
 
-    // Because we're not inserting or deleting components from the ECS or entity
-    // during threaded update steps, getting components is thread safe.
-	for (size_t idx = 0; idx < collection_size; idx++) {
-        ComponentID id = {entity, system->archetype->components[idx]};
-        data->collection[idx] = Manager_GetComponentByID(data->ecs, id);
-	}
+void ECS_RunTasks(ECS *ecs, size_t count, ecs_task_func func, void *udata)
+{
+    // Not worth waking anybody up for.
+    if (ecs->num_threads == 0 || count < 2) {
+        for (size_t idx = 0; idx < count; idx++) func(ecs, idx, udata);
+        return;
+    }
 
-	system->up_func(entity, data->collection, system->udata);
+    ecs->task_func = func;
+    ecs->task_data = udata;
+    __atomic_store_n(&ecs->tasks_left, count, __ATOMIC_RELEASE);
+
+    for (size_t idx = 0; idx < count; idx++) {
+        SystemQueueItem item = { SYSTEM_TASK, idx, 0, NULL, 0 };
+        ECS_PushJob(ecs, &item);
+    }
+
+    while (true) {
+        SystemQueueItem item;
+        if (take_job(ecs, 0, &item)) {
+            run_job(ecs, &item);
+            continue;
+        }
+
+        JOB_LOCK(ecs);
+        while (__atomic_load_n(&ecs->tasks_left, __ATOMIC_ACQUIRE) > 0
+            && __atomic_load_n(&ecs->queued_jobs, __ATOMIC_ACQUIRE) == 0)
+            pthread_cond_wait(&ecs->done_cond, &ecs->job_lock);
+        bool done = __atomic_load_n(&ecs->tasks_left, __ATOMIC_ACQUIRE) == 0;
+        JOB_UNLOCK(ecs);
+
+        if (done) break;
+    }
 }
 
-void UpdateThread_end(ThreadData *data)
+void ECS_RunJob(ECS *ecs, SystemQueueItem *item, Component **collection)
 {
-    data->running = false;
+    System *system = item->system;
+    hasharray_t *ha = system->ent_queue;
+
+    if (system->is_chunked) {
+        Manager_UpdateSystemChunks(ecs, system, collection, item->start, item->end);
+        return;
+    }
+
+    // Systems without any components are only updated once.
+    if (collection_size(system) == 0) {
+        Manager_CallSystem(system, 0, collection);
+        return;
+    }
+
+    Entity *entity;
+    if (item->end == 0) HA_FOR(ha, entity, item->start) {
+        Manager_UpdateSystem(ecs, system, *entity, collection);
+    }
+    else HA_RANGE_FOR(ha, entity, item->start, item->end) {
+        Manager_UpdateSystem(ecs, system, *entity, collection);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+// Resize the component buffer if it needs it.
+static bool reserve_collection(ThreadData *data, size_t collection_size)
+{
+    if (data->collection_size >= collection_size) return true;
+
+    Component **ptr = calloc(collection_size, sizeof(Component *));
+    if (!ptr) {
+        ECS_Error(data->ecs, "Failed to resize thread component buffer!");
+        return false;
+    }
+
     free(data->collection);
-    pthread_exit(NULL);
+    data->collection_size = collection_size;
+    data->collection = ptr;
+    return true;
 }
 
 void* UpdateThread_main(void *arg)
 {
     ThreadData *data = arg;
-    data->running = UpdateThread_start(data);
-
-    // Wait until there's a new system chunk to update.
-    while (data->running) {
-        THREAD_LOCK(data);
-        data->ready = true;
-        READY_THREAD(data->ecs);
-        pthread_cond_signal(&data->ecs->ready_cond);
-        while (data->ready) THREAD_WAIT(data);
-
-        System *system = data->system;
-        hasharray_t *ha = system->ent_queue;
-        size_t start = data->range.start;
-        size_t end = data->range.end;
-        THREAD_UNLOCK(data);
-
-        if (system->archetype->size == 0) {
-            UpdateThread_update(data, system, 0);
-            continue;
-        }
+    ECS *ecs = data->ecs;
+    current_thread = data;
 
-        hash_t *hash;
-        // Update the assigned chunk of the system.
-        if (end == 0) HA_FOR(ha, hash, start) {
-            UpdateThread_update(data, system, *hash);
-        }
-        else HA_RANGE_FOR(ha, hash, start, end) {
-            UpdateThread_update(data, system, *hash);
+    while (true) {
+        // Sleep until there are jobs to take.
+        JOB_LOCK(ecs);
+        ecs->sleeping_threads++;
+        pthread_cond_broadcast(&ecs->done_cond);
+        while (!ecs->stop_threads && __atomic_load_n(&ecs->queued_jobs, __ATOMIC_ACQUIRE) == 0)
+            pthread_cond_wait(&ecs->job_cond, &ecs->job_lock);
+        ecs->sleeping_threads--;
+        bool stop = ecs->stop_threads;
+        JOB_UNLOCK(ecs);
+
+        if (stop) break;
+
+        // Work through our own jobs first, then steal from the other threads.
+        SystemQueueItem item;
+        while (take_job(ecs, data->index, &item)) {
+            if (item.type == SYSTEM_TASK) {
+                run_task(ecs, &item);
+                continue;
+            }
+
+            if (reserve_collection(data, collection_size(item.system)))
+                ECS_RunJob(ecs, &item, data->collection);
+            finish_job(ecs, &item);
         }
     }
 
-    UpdateThread_end(data);
     return NULL;
 }
 
 void ThreadData_delete(ThreadData *data)
 {
-    pthread_mutex_destroy(&data->update_mutex);
-    pthread_cond_destroy(&data->update_cond);
+    pthread_mutex_destroy(&data->jobs.lock);
+    free(data->jobs.jobs);
     free(data->collection);
+    arena_free(&data->event_arenas[0]);
+    arena_free(&data->event_arenas[1]);
+
+    DYN_FOR(data->buffers, 0) CommandBuffer_Free(*(CommandBuffer **)dyn_get(&data->buffers, idx));
+    dyn_free(&data->buffers);
 }
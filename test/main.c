@@ -11,6 +11,7 @@ void TestComponent_new(TestComponent *comp)
 {
 	comp->string = malloc(16);
 	if (comp->string) strcpy(comp->string, "This is a test.");
+	comp->updates = 0;
 }
 void TestComponent_free(TestComponent *comp)
 {
@@ -23,6 +24,35 @@ const char* TestComponent_GetString(TestComponent *comp)
 	return comp->string;
 }
 
+COMPONENT_IMPL(TestChunkComponent, ComponentStorageChunked)
+void TestChunkComponent_new(TestChunkComponent *comp)
+{
+	comp->updates = 0;
+	comp->batch_updates = 0;
+}
+void TestChunkComponent_free(TestChunkComponent *comp)
+{
+}
+
+COMPONENT_IMPL(TestSparseComponent, ComponentStorageSparse)
+void TestSparseComponent_new(TestSparseComponent *comp)
+{
+	comp->owner = 0;
+}
+void TestSparseComponent_free(TestSparseComponent *comp)
+{
+}
+
+static void check_events(Event *events, size_t count, void *udata)
+{
+	hash_t *next_id = udata;
+	for (size_t idx = 0; idx < count; idx++) assert(events[idx].id == (*next_id)++);
+}
+
+#define TEST_EVENT 0x7e57
+#define TEST_PUBLISHED_EVENT 0x7e58
+#define TEST_EVENT_TARGETS 32
+
 SYSTEM_IMPL(TestSystem)
 void TestSystem_update(Entity e, Component **c, TestSystem *system)
 {
@@ -34,21 +64,103 @@ void TestSystem_update(Entity e, Component **c, TestSystem *system)
 	// safe to cast like this.
 	TestComponent *comp = c[0];
 	assert(TestComponent_GetString(comp));
+	comp->updates++;
+
+	// Worker threads can post events without any locking.
+	if (ENTITY_INDEX(e) % 1024 == 0) {
+		Event ev = { TEST_EVENT, e };
+		ECS_EventSetData(system->ecs, &ev, &e, sizeof(e));
+		ECS_SystemQueueEvent(system->ecs, "TestSystem", &ev);
+
+		// Bigger data goes to the thread's event arena instead.
+		Entity targets[TEST_EVENT_TARGETS];
+		for (int i = 0; i < TEST_EVENT_TARGETS; i++) targets[i] = e;
+		ev = (Event){ TEST_PUBLISHED_EVENT, e };
+		ECS_EventSetData(system->ecs, &ev, targets, sizeof(targets));
+		ECS_PublishEvent(system->ecs, &ev);
+	}
 }
 bool TestSystem_event(Event *event, TestSystem *system)
+{
+	assert(event->id == TEST_EVENT && ENTITY_INDEX(event->target) % 1024 == 0);
+	assert(event->is_inline && *(Entity *)event->data == event->target);
+	system->events++;
+	return false;
+}
+
+SYSTEM_IMPL(TestChunkSystem)
+void TestChunkSystem_update(Entity e, Component **c, TestChunkSystem *system)
+{
+	// Chunked components are handed out straight from the chunk's arrays.
+	TestChunkComponent *comp = c[0];
+	comp->updates++;
+
+	// TestBatchSystem is registered later, but has to update first.
+	assert(comp->batch_updates == comp->updates);
+}
+bool TestChunkSystem_event(Event *event, TestChunkSystem *system)
+{
+	// Dispatched alongside TestSystem's events, as they don't conflict.
+	assert(event->id == TEST_PUBLISHED_EVENT);
+	assert(((Entity *)event->data)[TEST_EVENT_TARGETS - 1] == event->target);
+	return false;
+}
+
+SYSTEM_BATCH_IMPL(TestBatchSystem)
+void TestBatchSystem_batch(size_t count, const Entity *e, Component **c, TestBatchSystem *system)
+{
+	// Each call gets a whole chunk's worth of components in one array.
+	TestChunkComponent *comps = c[0];
+	for (size_t idx = 0; idx < count; idx++) comps[idx].batch_updates++;
+}
+bool TestBatchSystem_event(Event *event, TestBatchSystem *system)
+{
+	assert(event->id == TEST_PUBLISHED_EVENT);
+	assert(((Entity *)event->data)[TEST_EVENT_TARGETS - 1] == event->target);
+	return false;
+}
+
+SYSTEM_IMPL(TestGlobalSystem)
+void TestGlobalSystem_update(Entity e, Component **c, TestGlobalSystem *system)
+{
+	// Systems without an archetype are updated once, without an entity.
+	assert(e == 0);
+	system->updates++;
+}
+bool TestGlobalSystem_event(Event *event, TestGlobalSystem *system)
 {
 	return false;
 }
 
 EntityArchetype *TestEntityArchetype;
 const char *TestEntity_components[] = {
-	"TestComponent", NULL
+	ComponentWrite(TestComponent), NULL
+};
+
+const char *TestChunkEntity_components[] = {
+	"TestChunkComponent", NULL
 };
 
 const SystemUpdateInfo TestSystem_update_info = {
 	true, false, false, NULL
 };
 
+const char *TestChunkSystem_after[] = {
+	"TestBatchSystem", NULL
+};
+
+const SystemUpdateInfo TestChunkSystem_update_info = {
+	true, false, false, TestChunkSystem_after
+};
+
+const SystemUpdateInfo TestBatchSystem_update_info = {
+	true, false, false, NULL
+};
+
+const SystemUpdateInfo TestGlobalSystem_update_info = {
+	true, false, false, NULL
+};
+
 #ifndef TEST_ENTITIES
 #define TEST_ENTITIES 1000000
 #endif
@@ -64,13 +176,37 @@ int main (int argc, const char **argv)
 	PERF_START();
 	bool res = REGISTER_COMPONENT(ecs, TestComponent);
 	assert(res);
+	res = REGISTER_COMPONENT(ecs, TestChunkComponent);
+	assert(res);
+	res = REGISTER_COMPONENT(ecs, TestSparseComponent);
+	assert(res);
 
 	TestSystem_reg.archetype = ECS_EntityRegisterArchetype(ecs, "TestEntityArchetype", TestEntity_components);
 
 	TestSystem *test_sys = malloc(sizeof(TestSystem));
+	test_sys->ecs = ecs;
+	test_sys->events = 0;
 	res = REGISTER_SYSTEM(ecs, TestSystem, test_sys);
 	assert(res);
 
+	TestChunkSystem_reg.archetype = ECS_EntityRegisterArchetype(ecs, "TestChunkEntityArchetype", TestChunkEntity_components);
+	res = REGISTER_SYSTEM(ecs, TestChunkSystem, NULL);
+	assert(res);
+
+	TestBatchSystem_reg.archetype = TestChunkSystem_reg.archetype;
+	res = REGISTER_SYSTEM(ecs, TestBatchSystem, NULL);
+	assert(res);
+
+	TestGlobalSystem global_sys = { 0 };
+	res = REGISTER_SYSTEM(ecs, TestGlobalSystem, &global_sys);
+	assert(res);
+
+	// Only the subscribers see published events.
+	res = ECS_SystemSubscribe(ecs, "TestChunkSystem", TEST_PUBLISHED_EVENT);
+	assert(res);
+	res = ECS_SystemSubscribe(ecs, "TestBatchSystem", TEST_PUBLISHED_EVENT);
+	assert(res);
+
 	res = ECS_SetThreads(ecs, 2);
 	assert(res);
 
@@ -79,14 +215,43 @@ int main (int argc, const char **argv)
 
 	PERF_UPDATE();
 	Entity entity;
+	Entity sparse_entities[1024];
 	TestComponent *comp;
 	hash_t comp_type = COMPONENT_ID(TestComponent);
+	hash_t chunk_type = COMPONENT_ID(TestChunkComponent);
+	hash_t sparse_type = COMPONENT_ID(TestSparseComponent);
+	res = ECS_Reserve(ecs, TEST_ENTITIES, (ECS_TypeCount[]){
+		{ comp_type, TEST_ENTITIES }, { chunk_type, TEST_ENTITIES }, { sparse_type, 1024 }, { 0 } });
+	assert(res);
 	for (int i = 0; i < TEST_ENTITIES; i++) {
 		entity = ECS_EntityNew(ecs, NULL);
 		comp = ECS_EntityAddComponent(ecs, entity, comp_type);
 		assert(comp);
+		assert(ECS_EntityAddComponent(ecs, entity, chunk_type));
+		if (i < 1024) sparse_entities[i] = entity;
+	}
+
+	// Churn sparse components, which move around inside their dense array.
+	for (int i = 0; i < 1024; i++) {
+		TestSparseComponent *sparse = ECS_EntityAddComponent(ecs, sparse_entities[i], sparse_type);
+		assert(sparse);
+		sparse->owner = sparse_entities[i];
+	}
+	for (int i = 0; i < 1024; i += 2) ECS_EntityRemoveComponent(ecs, sparse_entities[i], sparse_type);
+	for (int i = 0; i < 1024; i++) {
+		TestSparseComponent *sparse = ECS_EntityGetComponent(ecs, sparse_entities[i], sparse_type);
+		assert(i % 2 ? sparse && sparse->owner == sparse_entities[i] : !sparse);
 	}
 
+	// Deleted entities' handles stay invalid after their index is reused.
+	Entity stale = sparse_entities[0];
+	ECS_EntityDelete(ecs, stale);
+	assert(!ECS_EntityExists(ecs, stale));
+	sparse_entities[0] = ECS_EntityNew(ecs, NULL);
+	assert(ENTITY_INDEX(sparse_entities[0]) == ENTITY_INDEX(stale));
+	assert(ECS_EntityExists(ecs, sparse_entities[0]) && !ECS_EntityExists(ecs, stale));
+	assert(!ECS_EntityGetComponent(ecs, stale, comp_type));
+
 	PERF_PRINT_MS("Entity Creation");
 	printf("> Setup done (2/4).\n");
 
@@ -96,6 +261,169 @@ int main (int argc, const char **argv)
 	}
 	PERF_PRINT_MS("Updates");
 
+	TestChunkComponent *chunk_comp = ECS_EntityGetComponent(ecs, entity, chunk_type);
+	assert(chunk_comp && chunk_comp->updates == TEST_REPS);
+	assert(chunk_comp->batch_updates == TEST_REPS);
+	assert(global_sys.updates == TEST_REPS);
+	comp = ECS_EntityGetComponent(ecs, entity, comp_type);
+	assert(comp && comp->updates == TEST_REPS);
+
+	// Every entity with TestComponent at a multiple of 1024 posts an event
+	// each update; index 0 was reused for an entity without one.
+	assert(test_sys->events == TEST_REPS * ((TEST_ENTITIES - 1) / 1024));
+
+	// Entities created between updates are updated by the next one.
+	Entity late = ECS_EntityNew(ecs, NULL);
+	assert(ECS_EntityAddComponent(ecs, late, comp_type));
+
+	// Command buffers are played back at the end of the next update.
+	CommandBuffer *buff = CommandBuffer_New(ecs);
+	assert(buff);
+	Entity deferred = CommandBuffer_CreateEntity(buff);
+	CommandBuffer_AddComponent(buff, deferred, sparse_type);
+	CommandBuffer_AddComponent(buff, deferred, comp_type);
+	TestChunkComponent initial = { .updates = 3, .batch_updates = 3 };
+	CommandBuffer_AddComponentData(buff, deferred, chunk_type, &initial);
+	Entity cancelled = CommandBuffer_CreateEntity(buff);
+	CommandBuffer_AddComponent(buff, cancelled, comp_type);
+	CommandBuffer_DeleteEntity(buff, cancelled);
+	CommandBuffer_AddComponent(buff, sparse_entities[2], sparse_type);
+	CommandBuffer_AddComponent(buff, sparse_entities[4], sparse_type);
+	CommandBuffer_RemoveComponent(buff, sparse_entities[4], sparse_type);
+	CommandBuffer_DeleteEntity(buff, sparse_entities[6]);
+
+	// Published data is shared by the subscribers and freed only once.
+	assert(ECS_PublishEvent(ecs, &(Event){ TEST_PUBLISHED_EVENT, 0, calloc(TEST_EVENT_TARGETS, sizeof(Entity)), true }) == 2);
+	assert(ECS_PublishEvent(ecs, &(Event){ TEST_EVENT, 0, malloc(16), true }) == 0);
+
+	// Deferred entities have their IDs, but don't exist yet.
+	assert(deferred && !ECS_EntityExists(ecs, deferred));
+	ECS_Update(ecs);
+
+	assert(ECS_EntityGetComponent(ecs, deferred, sparse_type));
+	assert(TestComponent_GetString(ECS_EntityGetComponent(ecs, deferred, comp_type)));
+	chunk_comp = ECS_EntityGetComponent(ecs, deferred, chunk_type);
+	assert(chunk_comp && chunk_comp->updates == 3 && chunk_comp->batch_updates == 3);
+	assert(!ECS_EntityExists(ecs, cancelled));
+	comp = ECS_EntityGetComponent(ecs, late, comp_type);
+	assert(comp && comp->updates == 1);
+
+	assert(ECS_EntityGetComponent(ecs, sparse_entities[2], sparse_type));
+	assert(!ECS_EntityGetComponent(ecs, sparse_entities[4], sparse_type));
+	assert(!ECS_EntityExists(ecs, sparse_entities[6]));
+
+	// Deleting a buffer gives back the IDs it reserved.
+	buff = CommandBuffer_New(ecs);
+	assert(buff);
+	Entity discarded = CommandBuffer_CreateEntity(buff);
+	CommandBuffer_AddComponent(buff, discarded, comp_type);
+	CommandBuffer_Delete(buff);
+	ECS_Update(ecs);
+
+	// So are the ones played back from command buffers.
+	comp = ECS_EntityGetComponent(ecs, deferred, comp_type);
+	assert(comp && comp->updates == 1);
+
+	Entity recycled = ECS_EntityNew(ecs, NULL);
+	assert(ENTITY_INDEX(recycled) == ENTITY_INDEX(discarded) && recycled != discarded);
+	ECS_EntityDelete(ecs, recycled);
+
+	// Stale handles stay invalid however often their index is reused.
+	for (int i = 0; i < 2 * ENTITY_MAX_GENERATION; i++) {
+		Entity reused = ECS_EntityNew(ecs, NULL);
+		assert(reused && reused != discarded && !ECS_EntityExists(ecs, discarded));
+		ECS_EntityDelete(ecs, reused);
+	}
+
+	// Event queues keep their order while wrapping around and growing.
+	EventQueue *events = EventQueue_New();
+	assert(events);
+	for (hash_t id = 0; id < 24; id++) {
+		EventQueue_Push(events, &(Event){ id, 0, NULL, false });
+		if (id % 2) assert(EventQueue_Pop(events, NULL));
+	}
+	assert(EventQueue_Size(events) == 12 && EventQueue_Peek(events, 0)->id == 12);
+
+	hash_t next_id = 12;
+	assert(EventQueue_Drain(events, check_events, &next_id) == 12 && next_id == 24);
+	assert(EventQueue_Size(events) == 0 && !EventQueue_Pop(events, NULL));
+	EventQueue_Free(events);
+
+	// Hashtable entries keep their values while the index grows and drops
+	// deletions.
+	hashtable_t *table = ht_alloc(0, sizeof(hash_t));
+	assert(table);
+	for (hash_t key = 1; key <= 4096; key++) {
+		assert(ht_insert(table, key, &key));
+		if (key % 2 == 0) ht_delete(table, key);
+	}
+	assert(ht_len(table) == 2048 && *(hash_t *)ht_get(table, 1) == 1);
+	assert(!ht_get(table, 4096) && *(hash_t *)ht_get(table, 4095) == 4095);
+	assert(ht_get_free(table) == 2);
+
+	// Iteration follows insertion order and skips deleted entries.
+	hash_t expected = 1;
+	HT_ITER(table, it) {
+		assert(it.key == expected && *(hash_t *)it.value == expected);
+		expected += 2;
+	}
+	assert(expected == 4097 && ht_next(table, 4093) == 4095 && ht_next(table, 4096) == 0);
+	ht_free(table);
+
+	// Keys can be deleted and reinserted while the index is being migrated,
+	// whether they have been moved to the new index yet or not.
+	table = ht_alloc(0, sizeof(hash_t));
+	assert(table);
+	for (hash_t key = 1; key <= 4096; key++) {
+		assert(ht_insert(table, key, &key));
+		hash_t old_key = key / 2 + 1;
+		ht_delete(table, old_key);
+		assert(!ht_get(table, old_key) && ht_len(table) == key - 1);
+		assert(ht_insert(table, old_key, &old_key) && ht_len(table) == key);
+		assert(ht_get(table, old_key) != ht_get(table, key) || old_key == key);
+	}
+	for (hash_t key = 1; key <= 4096; key++) assert(*(hash_t *)ht_get(table, key) == key);
+	ht_free(table);
+
+	// Keys with the same low bits share a home group, and spill over into the
+	// groups after it.
+	table = ht_alloc(0, sizeof(hash_t));
+	assert(table);
+	for (hash_t key = 1; key <= 256; key++) assert(ht_insert(table, key << 16, &key));
+	for (hash_t key = 1; key <= 256; key += 2) ht_delete(table, key << 16);
+	for (hash_t key = 1; key <= 256; key++) {
+		hash_t *value = ht_get(table, key << 16);
+		assert(key % 2 ? !value : value && *value == key);
+	}
+	ht_free(table);
+
+	// Hash arrays find filled and free slots across word boundaries.
+	hasharray_t *array = ha_alloc(16, sizeof(hash_t));
+	assert(array);
+	for (hash_t idx = 0; idx < 200; idx++) assert(ha_insert(array, idx, &idx));
+	ha_delete(array, 64);
+	ha_delete(array, 130);
+	ha_delete(array, 199);
+	assert(ha_first_free(array) == 64 && ha_next_free(array, 64) == 130);
+	assert(ha_next_free(array, 130) == 199 && ha_next(array, 63) == 65);
+	assert(ha_last(array) == 199 && ha_next(array, 198) == 199);
+	for (hash_t idx = 0; idx < 199; idx++) ha_delete(array, idx);
+	assert(ha_len(array) == 0 && ha_last(array) == 0 && ha_first_free(array) == 0);
+	assert(ha_insert(array, 10, NULL) && ha_insert(array, 9000, NULL));
+	ha_delete(array, 9000);
+	assert(ha_last(array) == 11 && ha_next(array, 10) == 11);
+	ha_free(array);
+
+	// Dynamic arrays keep their order when inserting into the middle.
+	dynarray_t list;
+	assert(dyn_alloc(&list, 1, sizeof(int)));
+	for (int i = 0; i < 6; i += 2) assert(dyn_append(&list, &i));
+	assert(dyn_insert(&list, 1, &(int){ 1 }) && dyn_insert(&list, 3, &(int){ 3 }));
+	dyn_remove(&list, 0, false);
+	assert(list.size == 4 && list.capacity >= 5);
+	DYN_FOR(list, 0) assert(*(int *)dyn_get(&list, idx) == (int)idx + 1);
+	dyn_free(&list);
+
 	printf("> Update done (3/4).\n");
 
 	PERF_UPDATE();
@@ -5,8 +5,21 @@
 COMPONENT(TestComponent)
 struct TestComponent {
 	char *string;
+	// The number of times TestSystem updated the component.
+	uint32_t updates;
 };
 
 const char* TestComponent_GetString(TestComponent *c);
 
+COMPONENT(TestChunkComponent)
+struct TestChunkComponent {
+	uint32_t updates;
+	uint32_t batch_updates;
+};
+
+COMPONENT(TestSparseComponent)
+struct TestSparseComponent {
+	Entity owner;
+};
+
 #endif /* end of include guard: ECS_TESTCOMPONENT_H */
@@ -5,7 +5,25 @@
 
 SYSTEM(TestSystem)
 struct TestSystem {
-    // Nothing to see here, move along.
+    ECS *ecs;
+    // The number of events the system received.
+    size_t events;
+};
+
+SYSTEM(TestChunkSystem)
+struct TestChunkSystem {
+    // Nothing to see here either.
+};
+
+SYSTEM(TestBatchSystem)
+struct TestBatchSystem {
+    // Nothing to see here either.
+};
+
+SYSTEM(TestGlobalSystem)
+struct TestGlobalSystem {
+    // The number of times the system was updated.
+    size_t updates;
 };
 
 #endif /* end of include guard: TESTSYSTEM_H */